@@ -3,34 +3,347 @@
 #include <string.h>
 #include <ctype.h>
 #include <stdint.h>
+#include <limits.h>
 #include <pthread.h>
+#include <sched.h>
 #include <arpa/inet.h>
+#include <netinet/tcp.h>
 #include <unistd.h>
 #include <stdbool.h> // For boolean operations
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <signal.h>
+#include <time.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <poll.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#else
+#include <sys/event.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_SIMD 1
+#endif
 
-int INPUT_CHARACTER_LIMIT = 100;
 int OUTPUT_CHARACTER_LIMIT = 200;
 int PORT_NUMBER = 60000;
 int LEVENSHTEIN_LIST_LIMIT = 5;
+int LISTEN_BACKLOG = 128;
+int WORKER_THREADS = 0; // 0 = one per online CPU
+int LOOKUP_THREADS = 0; // 0 = one per online CPU
+int SCAN_THREADS = 0; // Threads sharing one word's scan, 0 = one per online CPU, 1 = no splitting
+int SCAN_CHUNK_WORDS = 16384; // Fewest words a scan slice gets, smaller dictionaries are scanned whole
+
+// Nearest-word search engine, selected with --engine at startup
+typedef enum {
+    ENGINE_SCAN,    // Brute-force scan over every dictionary word
+    ENGINE_BKTREE,  // BK-tree over Levenshtein distance, same results with pruning
+    ENGINE_DELETES, // SymSpell-style deletion index, only words within SYMSPELL_MAX_DISTANCE
+    ENGINE_TRIE     // Prefix trie walked with one DP row per node, shared prefixes computed once
+} SearchEngine;
+SearchEngine SEARCH_ENGINE = ENGINE_BKTREE;
+int SYMSPELL_MAX_DISTANCE = 2;
+
+// Distance kernel, selected with --kernel at startup
+typedef enum {
+    KERNEL_SIMD,  // Myers, and the scan compares up to 8 same-length words at once (AVX2/SSE2)
+    KERNEL_MYERS, // Bit-parallel (Myers/Hyyro) for words up to 64 characters, DP beyond
+    KERNEL_DP     // Classic dynamic programming, kept as the reference
+} LevenshteinKernel;
+LevenshteinKernel LEVENSHTEIN_KERNEL = KERNEL_SIMD;
+
+// Distance metric, chosen per connection with the 'metric' command
+typedef enum {
+    METRIC_LEVENSHTEIN, // Insertions, deletions and substitutions
+    METRIC_OSA          // Also swapping two adjacent characters ("form"/"from"), optimal string alignment
+} DistanceMetric;
+const char *DICTIONARY_FILE = "basic_english_2000.txt";
+const char *DICTIONARY_BINARY = NULL; // Compiled dictionary to map at startup (--binary)
+const char *COMPILE_OUTPUT = NULL; // Set by --compile: write the compiled dictionary and exit
+int DICTIONARY_OVERLAY_LIMIT = 1024; // Added words kept beside the index before it is rebuilt
+int WAL_COMPACT_RECORDS = 256; // Logged additions that trigger rewriting the word list
+int WAL_COMPACT_SECONDS = 30; // Idle time after which logged additions are folded in anyway
+int RESULT_CACHE_SIZE = 65536; // Cached word lookups, 0 disables the cache
+int INPUT_LINE_LIMIT = 8192; // Longest input line accepted (--max-line), longer ones are dropped with an error
 
 // Define constants
 #define WORD_LENGTH 50
 
-pthread_mutex_t telnet_mutex; // Mutex for synchronized Telnet communication
+// BK-tree node; node i holds dictionary word i and node 0 is the root.
+// Children form a linked list, each labelled with its distance to the parent.
+typedef struct {
+    uint32_t first_child; // 0 = no children (the root is never a child)
+    uint32_t next_sibling;
+    uint32_t distance;
+} BKTreeNode;
+
+// Prefix trie node. Nodes are laid out breadth-first, so the children of a
+// node are contiguous, sorted by character, and node 0 is the root.
+// The dictionary words ending at a node are trie_words[first_word ..
+// first_word + word_count), more than one if the word is listed repeatedly,
+// in the order a search ranks them.
+typedef struct {
+    uint32_t first_child;
+    uint32_t first_word;
+    uint16_t child_count;
+    uint8_t word_count; // Capped at 255, only LEVENSHTEIN_LIST_LIMIT can be reported
+    char character; // Edge from the parent
+} TrieNode;
+
+// Deletion-neighbourhood index: every string obtained by deleting up to
+// max_distance characters from a dictionary word, hashed, mapped to the words
+// it came from. Two words within max_distance edits share at least one such delete.
+typedef struct {
+    uint64_t *hashes; // Open-addressing table of delete hashes, 0 marks an empty slot
+    uint32_t *starts; // Per slot: first entry in postings
+    uint32_t *counts; // Per slot: number of entries in postings
+    uint32_t *postings; // Word indices grouped by delete hash
+    size_t table_size; // Power of two
+    size_t delete_count;
+    size_t posting_count;
+    int max_distance;
+} DeletionIndex;
+
+// Open-addressing set of dictionary words, holding word indices
+typedef struct {
+    int *slots; // -1 marks an empty slot
+    size_t mask;
+    size_t count;
+} WordSet;
+
+// Read-only dictionary snapshot shared by all connections.
+// A snapshot is never modified after it is published; adding a word or reloading
+// the file builds a new snapshot and swaps it in, so readers holding a reference
+// keep using the old one until they release it.
+// Words are stored back to back in one arena, each NUL-terminated, so a full
+// scan walks memory sequentially instead of chasing one pointer per word.
+typedef struct Dictionary {
+    char *arena;
+    size_t arena_size;
+    size_t arena_capacity;
+    uint32_t *offsets; // Start of each word in arena
+    uint8_t *lengths; // Precomputed word lengths (words are shorter than WORD_LENGTH)
+    uint32_t *frequencies; // Usage count of each word from the word list, 0 if not given
+    // Length buckets: length_order lists word indices sorted by (length, index),
+    // bucket L is length_order[length_starts[L] .. length_starts[L + 1]).
+    // columns holds each bucket transposed (character j of every word together,
+    // padded to a multiple of 8 words) so SIMD lanes load one byte per word.
+    uint32_t *length_order;
+    uint32_t length_starts[WORD_LENGTH + 1];
+    char *columns;
+    size_t column_offsets[WORD_LENGTH];
+    BKTreeNode *bktree; // NULL unless SEARCH_ENGINE is ENGINE_BKTREE
+    DeletionIndex *deletion_index; // NULL unless SEARCH_ENGINE is ENGINE_DELETES
+    TrieNode *trie; // NULL unless SEARCH_ENGINE is ENGINE_TRIE
+    size_t trie_node_count;
+    uint32_t *trie_words; // Word indices in trie order
+    WordSet words; // Exact-match set over the indexed words, not the overlay
+    int word_count;
+    int word_capacity;
+    atomic_int ref_count;
+    // Compiled dictionary file the arrays above point into, NULL when they are
+    // heap allocated. Mapped snapshots are read-only.
+    void *mapping;
+    size_t mapping_size;
+    // Words added after the arrays above were built, searched by a scan and
+    // numbered from word_count on. The slots (overlay_capacity words of
+    // WORD_LENGTH bytes) are shared by every snapshot of the same base and
+    // written once, before the snapshot that counts them is published.
+    char *overlay_words;
+    uint8_t *overlay_lengths;
+    int overlay_count;
+    int overlay_capacity;
+    // Overlay arrays the base outgrew; snapshots made before still read them
+    void **overlay_retired;
+    int overlay_retired_count;
+    // Set in snapshots made by adding a word: they share the arrays and the
+    // overlay of base and hold a reference to it instead of owning them
+    struct Dictionary *base;
+    struct Dictionary *retired_next; // Link in the list of snapshots waiting to be freed
+    uint64_t version; // Numbers the base arrays; snapshots sharing them have the same version
+} Dictionary;
+
+// Compiled dictionary file: this header, then each section at a multiple of
+// DICTIONARY_SECTION_ALIGNMENT. Sections hold the Dictionary arrays exactly as
+// they are in memory, with offsets instead of pointers, so the server maps the
+// file and uses them in place. Written in native byte order.
+#define DICTIONARY_FORMAT_VERSION 3
+#define DICTIONARY_SECTION_ALIGNMENT 64
+
+enum {
+    SECTION_ARENA,
+    SECTION_OFFSETS,
+    SECTION_LENGTHS,
+    SECTION_FREQUENCIES,
+    SECTION_LENGTH_ORDER,
+    SECTION_COLUMNS,
+    SECTION_BKTREE,
+    SECTION_DELETE_HASHES,
+    SECTION_DELETE_STARTS,
+    SECTION_DELETE_COUNTS,
+    SECTION_DELETE_POSTINGS,
+    SECTION_TRIE,
+    SECTION_TRIE_WORDS,
+    SECTION_COUNT
+};
+
+typedef struct {
+    uint64_t offset; // From the start of the file
+    uint64_t size; // In bytes, 0 for an absent section
+} DictionarySection;
+
+typedef struct {
+    char magic[8]; // "TASDICT"
+    uint32_t version; // DICTIONARY_FORMAT_VERSION
+    uint32_t byte_order; // 0x01020304 as stored by the compiling machine
+    uint32_t word_length; // WORD_LENGTH the length buckets were built with
+    uint32_t engine; // SEARCH_ENGINE the index sections belong to
+    uint32_t max_distance; // Deletion index depth
+    uint32_t word_count;
+    int64_t source_mtime; // Text file the dictionary was compiled from, to detect
+    uint64_t source_size; // a stale compiled file
+    uint64_t delete_table_size;
+    uint64_t delete_count;
+    uint32_t length_starts[WORD_LENGTH + 1];
+    uint32_t reserved;
+    uint64_t column_offsets[WORD_LENGTH];
+    DictionarySection sections[SECTION_COUNT];
+} DictionaryFileHeader;
+
+// The current snapshot is read without locks. Snapshots whose last reference
+// is gone are retired and freed once no dictionary_acquire can still be
+// looking at them: acquires count themselves in dictionary_readers[epoch & 1]
+// and dictionary_synchronize waits for both halves to drain in turn.
+_Atomic(Dictionary *) current_dictionary = NULL;
+atomic_uint dictionary_read_epoch = 0;
+atomic_long dictionary_readers[2];
+_Atomic(Dictionary *) dictionary_retired = NULL;
+atomic_uint_fast64_t dictionary_versions = 0;
+pthread_mutex_t dictionary_writer_mutex = PTHREAD_MUTEX_INITIALIZER; // Serializes reloads and additions
+pthread_mutex_t dictionary_file_mutex = PTHREAD_MUTEX_INITIALIZER; // Guards the word list file, its log and dictionary_mtime
+time_t dictionary_mtime = 0; // Modification time of the loaded dictionary file
+volatile sig_atomic_t dictionary_reload_requested = 0; // Set by SIGHUP
+
+int file_operations(const char *dictionary_file, Dictionary *dictionary);
+int dictionary_append(Dictionary *dictionary, const char *word, size_t length, uint32_t frequency);
+void dictionary_free(Dictionary *dictionary);
+void word_set_free(WordSet *set);
+Dictionary *dictionary_acquire(void);
+void dictionary_release(Dictionary *dictionary);
+Dictionary *dictionary_compact(const Dictionary *snapshot);
+time_t dictionary_file_mtime(const char *dictionary_file);
+int dictionary_build_buckets(Dictionary *dictionary);
+int bktree_build(Dictionary *dictionary);
+int deletion_index_build(Dictionary *dictionary);
+void deletion_index_free(DeletionIndex *index);
+void bktree_insert(Dictionary *dictionary, int index);
+
+// Position of a word scan over a NUL-terminated sentence
+typedef struct {
+    const char *input;
+    size_t position;
+} Tokenizer;
+
+// A word of a sentence as an offset into the sentence text, nothing is copied.
+// Offsets rather than pointers keep spans valid when the text is moved.
+typedef struct {
+    size_t offset;
+    size_t length;
+} WordSpan;
 
-void file_operations(const char *dictionary_file, char ***words, int *word_count);
-char **process_input(int *word_count, const char *input);
+WordSpan *process_input(int *word_count, char *input);
 void start_server(int port_number);
-void handle_client(int client_fd);
+
+// Work queue served by a fixed set of threads
+typedef struct Task {
+    void (*function)(void *);
+    void *argument;
+    struct Task *next;
+} Task;
+
+typedef struct {
+    pthread_t *threads;
+    int thread_count;
+    Task *head;
+    Task *tail;
+    pthread_mutex_t mutex;
+    pthread_cond_t task_available;
+} ThreadPool;
+
+ThreadPool worker_pool; // Runs client requests off the event loop
+ThreadPool lookup_pool; // Runs the per-word lookups of a sentence
+ThreadPool scan_pool; // Runs slices of one word's scan; its tasks never wait, so lookups can wait on them
+int scan_thread_count = 1;
+
+// Counts outstanding tasks so a submitter can wait for all of them
+typedef struct {
+    int pending;
+    pthread_mutex_t mutex;
+    pthread_cond_t finished;
+} TaskGroup;
+
+int thread_pool_submit(ThreadPool *pool, void (*function)(void *), void *argument);
+void task_group_init(TaskGroup *group, int pending);
+void task_group_done(TaskGroup *group);
+void task_group_wait(TaskGroup *group);
+
+// Growable byte buffer for assembling responses
+typedef struct {
+    char *data;
+    size_t length;
+    size_t capacity;
+} OutputBuffer;
+
+void output_append(OutputBuffer *output, const char *data, size_t length);
+void output_printf(OutputBuffer *output, const char *format, ...);
+
+// Per-connection lookup settings
+typedef struct {
+    bool neighbors; // Search known words too, instead of answering them as exact matches
+    DistanceMetric metric;
+} LookupOptions;
+
+// A client connection. While a worker handles it the socket is not armed in
+// the event queue, so only one thread touches a connection at a time.
+typedef struct {
+    int fd;
+    // Received bytes, grown to hold a line of up to INPUT_LINE_LIMIT bytes;
+    // batch clients pipeline many lines. Bytes before buffer_start are consumed.
+    char *buffer;
+    size_t buffer_start;
+    size_t buffer_length;
+    size_t buffer_capacity;
+    size_t buffer_scanned; // Bytes up to here hold no newline, so each is searched once
+    bool discarding_line; // Input is dropped up to the next newline, the line was too long
+    struct SentenceRequest *request; // Sentence waiting for an add-word answer, NULL otherwise
+    bool batch_mode; // One machine-readable result line per input line, no prompts
+    LookupOptions options; // Set by the 'neighbors' and 'metric' commands
+    bool peer_closed; // The client shut down its side; finish buffered lines, then close
+    // Everything a request writes is collected here and sent with one send()
+    OutputBuffer output;
+    size_t output_sent; // Bytes of output already written to the socket
+    bool close_after_flush;
+} Connection;
+
+int event_queue = -1; // epoll instance, or kqueue where epoll is not available
+
+void handle_client(Connection *connection);
+void sentence_request_free(struct SentenceRequest *request);
 
 // Define the WordDistance structure
 typedef struct {
-    char *word;
+    const char *word;
     size_t distance;
+    uint32_t frequency; // Breaks ties between equal distances, the more frequent word first
+    int index; // Dictionary position, breaks the remaining ties
 } WordDistance;
 
 size_t
-levenshtein_n(const char *a, const size_t length, const char *b, const size_t bLength) {
+levenshtein_dp(const char *a, const size_t length, const char *b, const size_t bLength) {
     // Shortcut optimizations / degenerate cases.
     if (a == b) {
         return 0;
@@ -83,401 +396,3874 @@ levenshtein_n(const char *a, const size_t length, const char *b, const size_t bL
     return result;
 }
 
-
+// levenshtein_dp that gives up once every cell of the current row exceeds max.
+// Returns the exact distance when it is at most max, otherwise max + 1.
 size_t
-levenshtein(const char *a, const char *b) {
-    const size_t length = strlen(a);
-    const size_t bLength = strlen(b);
+levenshtein_dp_bounded(const char *a, const size_t length, const char *b, const size_t bLength, const size_t max) {
+    if (length == 0 || bLength == 0) {
+        return length + bLength;
+    }
 
-    return levenshtein_n(a, length, b, bLength);
-}
+    size_t *cache = calloc(length, sizeof(size_t));
+    size_t index = 0;
+    size_t bIndex = 0;
+    size_t distance;
+    size_t bDistance;
+    size_t result;
+    size_t row_minimum;
+    char code;
 
-void file_operations(const char *dictionary_file, char ***words, int *word_count) {
-    FILE *file;
-    char buffer[WORD_LENGTH];
-    int capacity = 10;
-    *words = (char **)malloc(capacity * sizeof(char *));
-    if (*words == NULL) {
-        fprintf(stderr, "ERROR: Memory allocation failed.\n");
-        exit(EXIT_FAILURE);
+    while (index < length) {
+        cache[index] = index + 1;
+        index++;
     }
 
-    file = fopen(dictionary_file, "r");
-    if (file == NULL) {
-        fprintf(stderr, "ERROR: Dictionary file \"%s\" not found!\n", dictionary_file);
-        free(*words);
-        exit(EXIT_FAILURE);
-    }
+    while (bIndex < bLength) {
+        code = b[bIndex];
+        result = distance = bIndex++;
+        row_minimum = result;
+        index = SIZE_MAX;
 
-    *word_count = 0;
-    while (fscanf(file, "%49s", buffer) != EOF) {
-        if (*word_count >= capacity) {
-            capacity *= 2;
-            *words = (char **)realloc(*words, capacity * sizeof(char *));
-            if (*words == NULL) {
-                fprintf(stderr, "ERROR: Memory reallocation failed.\n");
-                fclose(file);
-                exit(EXIT_FAILURE);
+        while (++index < length) {
+            bDistance = code == a[index] ? distance : distance + 1;
+            distance = cache[index];
+
+            cache[index] = result = distance > result
+              ? bDistance > result
+                ? result + 1
+                : bDistance
+              : bDistance > distance
+                ? distance + 1
+                : bDistance;
+            if (result < row_minimum) {
+                row_minimum = result;
             }
         }
 
-        (*words)[*word_count] = (char *)malloc((strlen(buffer) + 1) * sizeof(char));
-        if ((*words)[*word_count] == NULL) {
-            fprintf(stderr, "ERROR: Memory allocation failed for word.\n");
-            fclose(file);
-            exit(EXIT_FAILURE);
+        // Distances never shrink from one row to the next
+        if (row_minimum > max) {
+            free(cache);
+            return max + 1;
         }
-        strcpy((*words)[*word_count], buffer);
-        (*word_count)++;
     }
 
-    fclose(file);
+    free(cache);
+
+    return result;
 }
 
-char **process_input(int *word_count, const char *input) {
-    char *processed_input;
-    char **words = NULL;
-    int i, j = 0;
-    processed_input = (char *)malloc((strlen(input) + 1) * sizeof(char));
-    if (processed_input == NULL) {
-        fprintf(stderr, "ERROR: Memory allocation failed.\n");
-        return NULL;
-    }
 
-    for (i = 0; input[i] != '\0'; i++) {
-        if (isalpha(input[i]) || isspace(input[i])) {
-            processed_input[j++] = tolower(input[i]);
+// Bit-parallel Levenshtein distance (Myers 1999, Hyyro 2001). Bit i of the
+// vertical delta vectors describes row i of the DP column, so one text
+// character advances a whole column of up to 64 pattern characters at once.
+// peq[c] has bit i set where pattern[i] == c; pattern_length is 1..64.
+// The last-row score changes by at most one per text character, so once it
+// exceeds max by more than the characters left the result cannot come back
+// under max and max + 1 is returned. Pass SIZE_MAX for the exact distance.
+static inline size_t
+levenshtein_myers(const uint64_t *peq, const size_t pattern_length, const char *b, const size_t bLength, const size_t max) {
+    uint64_t positive_vertical = ~(uint64_t)0;
+    uint64_t negative_vertical = 0;
+    const uint64_t last_row = (uint64_t)1 << (pattern_length - 1);
+    size_t score = pattern_length;
+
+    for (size_t bIndex = 0; bIndex < bLength; bIndex++) {
+        uint64_t equal = peq[(unsigned char)b[bIndex]];
+        uint64_t vertical = equal | negative_vertical;
+        uint64_t horizontal = (((equal & positive_vertical) + positive_vertical) ^ positive_vertical) | equal;
+        uint64_t positive_horizontal = negative_vertical | ~(horizontal | positive_vertical);
+        uint64_t negative_horizontal = positive_vertical & horizontal;
+
+        if (positive_horizontal & last_row) {
+            score++;
+        } else if (negative_horizontal & last_row) {
+            score--;
         }
-    }
-    processed_input[j] = '\0';
 
-    char *token = strtok(processed_input, " ");
-    while (token != NULL) {
-        words = (char **)realloc(words, (*word_count + 1) * sizeof(char *));
-        if (words == NULL) {
-            fprintf(stderr, "ERROR: Memory reallocation failed.\n");
-            free(processed_input);
-            return NULL;
+        // Row 0 of the DP grows by one per text character
+        positive_horizontal = (positive_horizontal << 1) | 1;
+        negative_horizontal <<= 1;
+        positive_vertical = negative_horizontal | ~(vertical | positive_horizontal);
+        negative_vertical = positive_horizontal & vertical;
+
+        if (score > max && score - max > bLength - bIndex - 1) {
+            return max + 1;
         }
+    }
+
+    return score;
+}
+
+// Optimal string alignment distance: Levenshtein plus transposition of two
+// adjacent characters as one edit, no substring edited twice. Keeps the rows
+// for b characters i - 2, i - 1 and i. Row minima never shrink (a
+// transposition costs as much as the diagonal step before it), so it gives
+// up once a whole row exceeds max and returns max + 1.
+size_t
+osa_dp_bounded(const char *a, const size_t length, const char *b, const size_t bLength, const size_t max) {
+    if (length == 0 || bLength == 0) {
+        return length + bLength;
+    }
+
+    size_t *rows = (size_t *)malloc(3 * (length + 1) * sizeof(size_t));
+    if (rows == NULL) {
+        fprintf(stderr, "ERROR: Memory allocation failed.\n");
+        return levenshtein_dp_bounded(a, length, b, bLength, max);
+    }
+    size_t *before = rows;
+    size_t *previous = rows + (length + 1);
+    size_t *current = rows + 2 * (length + 1);
+    for (size_t j = 0; j <= length; j++) {
+        previous[j] = j;
+    }
 
-        words[*word_count] = (char *)malloc((strlen(token) + 1) * sizeof(char));
-        if (words[*word_count] == NULL) {
-            fprintf(stderr, "ERROR: Memory allocation failed for word.\n");
-            free(processed_input);
-            for (int k = 0; k < *word_count; k++) {
-                free(words[k]);
+    for (size_t i = 1; i <= bLength; i++) {
+        current[0] = i;
+        size_t row_minimum = i;
+        for (size_t j = 1; j <= length; j++) {
+            size_t value = previous[j - 1] + (a[j - 1] != b[i - 1]);
+            if (previous[j] + 1 < value) {
+                value = previous[j] + 1;
+            }
+            if (current[j - 1] + 1 < value) {
+                value = current[j - 1] + 1;
+            }
+            if (i > 1 && j > 1 && a[j - 1] == b[i - 2] && a[j - 2] == b[i - 1] && before[j - 2] + 1 < value) {
+                value = before[j - 2] + 1;
+            }
+            current[j] = value;
+            if (value < row_minimum) {
+                row_minimum = value;
             }
-            free(words);
-            return NULL;
         }
-        strcpy(words[*word_count], token);
-        (*word_count)++;
-        token = strtok(NULL, " ");
+        if (row_minimum > max) {
+            free(rows);
+            return max + 1;
+        }
+
+        size_t *recycled = before;
+        before = previous;
+        previous = current;
+        current = recycled;
     }
 
-    free(processed_input);
-    return words;
+    size_t result = previous[length];
+    free(rows);
+    return result;
 }
 
-void find_closest_words(const char *input_word, char **dictionary_words, int dictionary_size, char **closest_word, int *is_word_found, int client_fd) {
-    typedef struct {
-        char *word;
-        size_t distance;
-    } WordDistance;
+// Bit-parallel optimal string alignment distance (Hyyro 2003): Myers'
+// recurrence with a transposition term. A diagonal step can come from two
+// rows and two columns back when the pattern and text characters cross,
+// which is where pattern[i] matched the previous text character, pattern[i - 1]
+// matches this one and the previous diagonal step was not free.
+// Same interface and early exit as levenshtein_myers.
+static inline size_t
+osa_myers(const uint64_t *peq, const size_t pattern_length, const char *b, const size_t bLength, const size_t max) {
+    uint64_t positive_vertical = ~(uint64_t)0;
+    uint64_t negative_vertical = 0;
+    uint64_t zero_diagonal = 0;
+    uint64_t previous_equal = 0;
+    const uint64_t last_row = (uint64_t)1 << (pattern_length - 1);
+    size_t score = pattern_length;
 
-    WordDistance closest[LEVENSHTEIN_LIST_LIMIT];
-    for (int i = 0; i < LEVENSHTEIN_LIST_LIMIT; i++) {
-        closest[i].word = NULL;
-        closest[i].distance = SIZE_MAX;
-    }
+    for (size_t bIndex = 0; bIndex < bLength; bIndex++) {
+        uint64_t equal = peq[(unsigned char)b[bIndex]];
+        uint64_t transposed = (((~zero_diagonal) & equal) << 1) & previous_equal;
+        zero_diagonal = (((equal & positive_vertical) + positive_vertical) ^ positive_vertical) | equal | negative_vertical | transposed;
+        uint64_t positive_horizontal = negative_vertical | ~(zero_diagonal | positive_vertical);
+        uint64_t negative_horizontal = zero_diagonal & positive_vertical;
 
-    for (int i = 0; i < dictionary_size; i++) {
-        size_t distance = levenshtein(input_word, dictionary_words[i]);
-        if (distance == 0) {
-            *is_word_found = 1;
+        if (positive_horizontal & last_row) {
+            score++;
+        } else if (negative_horizontal & last_row) {
+            score--;
         }
 
-        for (int j = 0; j < LEVENSHTEIN_LIST_LIMIT; j++) {
-            if (distance < closest[j].distance) {
-                for (int k = LEVENSHTEIN_LIST_LIMIT - 1; k > j; k--) {
-                    closest[k] = closest[k - 1];
-                }
-                closest[j].word = dictionary_words[i];
-                closest[j].distance = distance;
-                break;
-            }
+        positive_horizontal = (positive_horizontal << 1) | 1;
+        negative_horizontal <<= 1;
+        positive_vertical = negative_horizontal | ~(zero_diagonal | positive_horizontal);
+        negative_vertical = positive_horizontal & zero_diagonal;
+        previous_equal = equal;
+
+        if (score > max && score - max > bLength - bIndex - 1) {
+            return max + 1;
         }
     }
 
-    if (closest[0].word != NULL) {
-        *closest_word = closest[0].word;
+    return score;
+}
+
+// Exact distance when it is at most max, otherwise some value above max.
+// The reference DP kernel is never bounded.
+size_t
+levenshtein_bounded(const char *a, const size_t length, const char *b, const size_t bLength, const size_t max) {
+    if (LEVENSHTEIN_KERNEL == KERNEL_DP) {
+        return levenshtein_dp(a, length, b, bLength);
     }
 
-    char message[1024];
-    snprintf(message, sizeof(message), "MATCHES: ");
-    send(client_fd, message, strlen(message), 0);
-    for (int i = 0; i < LEVENSHTEIN_LIST_LIMIT && closest[i].word != NULL; i++) {
-        snprintf(message, sizeof(message), "%s (%zu) ", closest[i].word, closest[i].distance);
-        send(client_fd, message, strlen(message), 0);
+    // The distance is at least the length difference
+    const size_t length_difference = length > bLength ? length - bLength : bLength - length;
+    if (length_difference > max) {
+        return max + 1;
     }
-    snprintf(message, sizeof(message), "\n");
-    send(client_fd, message, strlen(message), 0);
-}
 
-typedef struct {
-    char *input_word;
-    char **dictionary_words;
-    int dictionary_size;
-    int is_word_found;
-    char *closest_word;
-    int client_fd;
-    int word_position;
-} ThreadData;
+    // Use the shorter string as the bit-parallel pattern
+    const char *pattern = length <= bLength ? a : b;
+    const char *text = length <= bLength ? b : a;
+    const size_t pattern_length = length <= bLength ? length : bLength;
+    const size_t text_length = length <= bLength ? bLength : length;
 
+    if (pattern_length == 0) {
+        return text_length;
+    }
+    if (pattern_length > 64) {
+        return levenshtein_dp_bounded(pattern, pattern_length, text, text_length, max);
+    }
 
+    // Only the entries looked up below are initialized, no 2 KiB memset per call
+    uint64_t peq[256];
+    for (size_t i = 0; i < pattern_length; i++) {
+        peq[(unsigned char)pattern[i]] = 0;
+    }
+    for (size_t i = 0; i < text_length; i++) {
+        peq[(unsigned char)text[i]] = 0;
+    }
+    for (size_t i = 0; i < pattern_length; i++) {
+        peq[(unsigned char)pattern[i]] |= (uint64_t)1 << i;
+    }
 
-int main(void) {
-    pthread_mutex_init(&telnet_mutex, NULL);
-    printf("Sunucu %d portunda başlatılıyor...\n", PORT_NUMBER);
-    start_server(PORT_NUMBER);
-    pthread_mutex_destroy(&telnet_mutex);
+    return levenshtein_myers(peq, pattern_length, text, text_length, max);
 }
 
-void start_server(int port_number) {
-    int server_fd = socket(AF_INET, SOCK_STREAM, 0);
-    if (server_fd == -1) {
-        perror("ERROR: Failed to create socket");
-        exit(EXIT_FAILURE);
+// levenshtein_bounded for the optimal string alignment distance
+size_t
+osa_bounded(const char *a, const size_t length, const char *b, const size_t bLength, const size_t max) {
+    if (LEVENSHTEIN_KERNEL == KERNEL_DP) {
+        return osa_dp_bounded(a, length, b, bLength, SIZE_MAX);
     }
 
-    // Set SO_REUSEADDR to allow reuse of the port
-    int opt = 1;
-    if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0) {
-        perror("ERROR: Failed to set socket options");
-        close(server_fd);
-        exit(EXIT_FAILURE);
+    const size_t length_difference = length > bLength ? length - bLength : bLength - length;
+    if (length_difference > max) {
+        return max + 1;
     }
 
-    struct sockaddr_in server_addr;
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_addr.s_addr = INADDR_ANY;
-    server_addr.sin_port = htons(port_number);
+    // The distance is symmetric, the shorter string is the pattern
+    const char *pattern = length <= bLength ? a : b;
+    const char *text = length <= bLength ? b : a;
+    const size_t pattern_length = length <= bLength ? length : bLength;
+    const size_t text_length = length <= bLength ? bLength : length;
 
-    if (bind(server_fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) == -1) {
-        perror("ERROR: Failed to bind socket");
-        close(server_fd); // Close the socket to release the port
-        exit(EXIT_FAILURE);
+    if (pattern_length == 0) {
+        return text_length;
+    }
+    if (pattern_length > 64) {
+        return osa_dp_bounded(pattern, pattern_length, text, text_length, max);
     }
 
-    if (listen(server_fd, 5) == -1) {
-        perror("ERROR: Failed to listen on socket");
-        close(server_fd); // Close the socket to release the port
-        exit(EXIT_FAILURE);
+    uint64_t peq[256];
+    for (size_t i = 0; i < pattern_length; i++) {
+        peq[(unsigned char)pattern[i]] = 0;
+    }
+    for (size_t i = 0; i < text_length; i++) {
+        peq[(unsigned char)text[i]] = 0;
+    }
+    for (size_t i = 0; i < pattern_length; i++) {
+        peq[(unsigned char)pattern[i]] |= (uint64_t)1 << i;
     }
 
-    printf("Server running on port %d\n", port_number);
+    return osa_myers(peq, pattern_length, text, text_length, max);
+}
 
-    while (1) {
-        int client_fd = accept(server_fd, NULL, NULL);
-        if (client_fd == -1) {
-            perror("ERROR: Failed to accept connection");
-            continue;
-        }
+size_t
+levenshtein_n(const char *a, const size_t length, const char *b, const size_t bLength) {
+    return levenshtein_bounded(a, length, b, bLength, SIZE_MAX);
+}
 
-        handle_client(client_fd);
-    }
+// An input word prepared once for comparison against many dictionary words
+typedef struct {
+    const char *word;
+    size_t length;
+    bool bit_parallel; // peq is valid
+    bool batched; // peq32 is valid and levenshtein_batch may be used
+    bool transpositions; // Measure optimal string alignment instead of Levenshtein distance
+    uint64_t peq[256];
+    uint32_t peq32[256]; // Low 32 bits of peq, table for the SIMD gather
+} LevenshteinQuery;
 
-    close(server_fd); // Close the server socket when done
+void levenshtein_query_init(LevenshteinQuery *query, const char *word, size_t length, DistanceMetric metric) {
+    query->word = word;
+    query->length = length;
+    query->transpositions = metric == METRIC_OSA;
+    query->bit_parallel = LEVENSHTEIN_KERNEL != KERNEL_DP && length > 0 && length <= 64;
+    // The batched kernels only know Levenshtein; OSA scans run osa_myers per word
+    query->batched = LEVENSHTEIN_KERNEL == KERNEL_SIMD && length > 0 && length <= 32 && !query->transpositions;
+    if (query->bit_parallel) {
+        memset(query->peq, 0, sizeof(query->peq));
+        for (size_t i = 0; i < length; i++) {
+            query->peq[(unsigned char)word[i]] |= (uint64_t)1 << i;
+        }
+    }
+    if (query->batched) {
+        for (int c = 0; c < 256; c++) {
+            query->peq32[c] = (uint32_t)query->peq[c];
+        }
+    }
 }
 
-void *thread_function(void *arg) {
-    ThreadData *data = (ThreadData *)arg;
-    pthread_mutex_lock(&telnet_mutex);
-
-    // Display the word and its position
-    char response_message[1024];
-    snprintf(response_message, sizeof(response_message), "\nWORD %02d: %s\n", data->word_position, data->input_word);
-    send(data->client_fd, response_message, strlen(response_message), 0);
-
-    // Find closest words
-    find_closest_words(data->input_word, data->dictionary_words, data->dictionary_size, &data->closest_word, &data->is_word_found, data->client_fd);
-
-    // If word is not found, ask if the user wants to add it
-    if (!data->is_word_found) {
-        char not_found_message[1024];
-        snprintf(not_found_message, sizeof(not_found_message),
-                 "\nThe WORD %s is not present in dictionary. \nDo you want to add this word to dictionary? (y/N): ",
-                 data->input_word);
-        send(data->client_fd, not_found_message, strlen(not_found_message), 0);
-
-        char buffer[1024];
-        int response_received = recv(data->client_fd, buffer, sizeof(buffer) - 1, 0);
-        if (response_received > 0) {
-            buffer[response_received] = '\0';
-            if (buffer[0] == 'y' || buffer[0] == 'Y') {
-
-                data->is_word_found = 1;
-                // Update in-memory dictionary
-                data->dictionary_words = (char **)realloc(data->dictionary_words, (data->dictionary_size + 1) * sizeof(char *));
-                if (data->dictionary_words != NULL) {
-                    data->dictionary_words[data->dictionary_size] = (char *)malloc((strlen(data->input_word) + 1) * sizeof(char));
-                    if (data->dictionary_words[data->dictionary_size] != NULL) {
-                        strcpy(data->dictionary_words[data->dictionary_size], data->input_word);
-                        data->dictionary_size++;
-
-                        // Write to dictionary file
-                        FILE *file = fopen("basic_english_2000.txt", "a");
-                        if (file != NULL) {
-                            fprintf(file, "%s\n", data->input_word);
-                            fclose(file);
-                        }
-                        const char *added_message = "The word has been added to the dictionary.\n";
-                        send(data->client_fd, added_message, strlen(added_message), 0);
-                    }
-                }
-            } else if (buffer[0] == 'n' || buffer[0] == 'N'){
-                const char *skipped_message = "The word has been skipped.\n";
-                send(data->client_fd, skipped_message, strlen(skipped_message), 0);
-            }else {
-                const char *error_message = "ERROR: Invalid input, closing connection...\n";
-                send(data->client_fd, error_message, strlen(error_message), 0);
-                close(data->client_fd); // Close the client connection
-                exit(EXIT_FAILURE); // Shut down the server
-            }
+// Batched kernels: distances from the query to the words of one length bucket.
+// columns[j * stride + lane] is character j of word lane, all words have
+// length characters and lanes is a multiple of 8. The query is at most 32
+// characters so each lane runs Myers in 32 bits.
+void levenshtein_batch_scalar(const LevenshteinQuery *query, const char *columns, size_t stride, size_t length, size_t lanes, uint32_t *distances) {
+    const uint32_t last_row = (uint32_t)1 << (query->length - 1);
+    for (size_t lane = 0; lane < lanes; lane++) {
+        uint32_t positive_vertical = ~(uint32_t)0;
+        uint32_t negative_vertical = 0;
+        uint32_t score = (uint32_t)query->length;
+        for (size_t j = 0; j < length; j++) {
+            uint32_t equal = query->peq32[(unsigned char)columns[j * stride + lane]];
+            uint32_t vertical = equal | negative_vertical;
+            uint32_t horizontal = (((equal & positive_vertical) + positive_vertical) ^ positive_vertical) | equal;
+            uint32_t positive_horizontal = negative_vertical | ~(horizontal | positive_vertical);
+            uint32_t negative_horizontal = positive_vertical & horizontal;
+            score += (positive_horizontal & last_row) != 0;
+            score -= (negative_horizontal & last_row) != 0;
+            positive_horizontal = (positive_horizontal << 1) | 1;
+            negative_horizontal <<= 1;
+            positive_vertical = negative_horizontal | ~(vertical | positive_horizontal);
+            negative_vertical = positive_horizontal & vertical;
         }
+        distances[lane] = score;
     }
-
-    pthread_mutex_unlock(&telnet_mutex);
-    return NULL;
 }
 
-void process_and_send_words(int client_fd, const char *input, char **dictionary_words, int dict_word_count) {
-    int input_word_count = 0;
-    char **input_words = process_input(&input_word_count, input);
-    if (input_words == NULL) {
-        return;
+#ifdef HAVE_X86_SIMD
+__attribute__((target("sse2")))
+void levenshtein_batch_sse2(const LevenshteinQuery *query, const char *columns, size_t stride, size_t length, size_t lanes, uint32_t *distances) {
+    const __m128i all_ones = _mm_set1_epi32(-1);
+    const __m128i one = _mm_set1_epi32(1);
+    const __m128i last_row = _mm_set1_epi32((int)((uint32_t)1 << (query->length - 1)));
+    const uint32_t *peq = query->peq32;
+
+    for (size_t group = 0; group < lanes; group += 4) {
+        __m128i positive_vertical = all_ones;
+        __m128i negative_vertical = _mm_setzero_si128();
+        __m128i score = _mm_set1_epi32((int)query->length);
+        for (size_t j = 0; j < length; j++) {
+            const unsigned char *chars = (const unsigned char *)columns + j * stride + group;
+            __m128i equal = _mm_set_epi32((int)peq[chars[3]], (int)peq[chars[2]], (int)peq[chars[1]], (int)peq[chars[0]]);
+            __m128i vertical = _mm_or_si128(equal, negative_vertical);
+            __m128i sum = _mm_add_epi32(_mm_and_si128(equal, positive_vertical), positive_vertical);
+            __m128i horizontal = _mm_or_si128(_mm_xor_si128(sum, positive_vertical), equal);
+            __m128i positive_horizontal = _mm_or_si128(negative_vertical, _mm_andnot_si128(_mm_or_si128(horizontal, positive_vertical), all_ones));
+            __m128i negative_horizontal = _mm_and_si128(positive_vertical, horizontal);
+            // cmpeq yields -1 in lanes where the last row bit is set
+            score = _mm_sub_epi32(score, _mm_cmpeq_epi32(_mm_and_si128(positive_horizontal, last_row), last_row));
+            score = _mm_add_epi32(score, _mm_cmpeq_epi32(_mm_and_si128(negative_horizontal, last_row), last_row));
+            positive_horizontal = _mm_or_si128(_mm_slli_epi32(positive_horizontal, 1), one);
+            negative_horizontal = _mm_slli_epi32(negative_horizontal, 1);
+            positive_vertical = _mm_or_si128(negative_horizontal, _mm_andnot_si128(_mm_or_si128(vertical, positive_horizontal), all_ones));
+            negative_vertical = _mm_and_si128(positive_horizontal, vertical);
+        }
+        _mm_storeu_si128((__m128i *)(distances + group), score);
     }
-    const char *dictionary_file = "basic_english_2000.txt";
+}
 
-    file_operations(dictionary_file, &dictionary_words, &dict_word_count);
+__attribute__((target("avx2")))
+void levenshtein_batch_avx2(const LevenshteinQuery *query, const char *columns, size_t stride, size_t length, size_t lanes, uint32_t *distances) {
+    const __m256i all_ones = _mm256_set1_epi32(-1);
+    const __m256i one = _mm256_set1_epi32(1);
+    const __m256i last_row = _mm256_set1_epi32((int)((uint32_t)1 << (query->length - 1)));
+    const int *peq = (const int *)query->peq32;
 
-    pthread_t threads[input_word_count];
-    ThreadData thread_data[input_word_count];
+    for (size_t group = 0; group < lanes; group += 8) {
+        __m256i positive_vertical = all_ones;
+        __m256i negative_vertical = _mm256_setzero_si256();
+        __m256i score = _mm256_set1_epi32((int)query->length);
+        for (size_t j = 0; j < length; j++) {
+            __m128i chars = _mm_loadl_epi64((const __m128i *)(columns + j * stride + group));
+            __m256i equal = _mm256_i32gather_epi32(peq, _mm256_cvtepu8_epi32(chars), 4);
+            __m256i vertical = _mm256_or_si256(equal, negative_vertical);
+            __m256i sum = _mm256_add_epi32(_mm256_and_si256(equal, positive_vertical), positive_vertical);
+            __m256i horizontal = _mm256_or_si256(_mm256_xor_si256(sum, positive_vertical), equal);
+            __m256i positive_horizontal = _mm256_or_si256(negative_vertical, _mm256_andnot_si256(_mm256_or_si256(horizontal, positive_vertical), all_ones));
+            __m256i negative_horizontal = _mm256_and_si256(positive_vertical, horizontal);
+            score = _mm256_sub_epi32(score, _mm256_cmpeq_epi32(_mm256_and_si256(positive_horizontal, last_row), last_row));
+            score = _mm256_add_epi32(score, _mm256_cmpeq_epi32(_mm256_and_si256(negative_horizontal, last_row), last_row));
+            positive_horizontal = _mm256_or_si256(_mm256_slli_epi32(positive_horizontal, 1), one);
+            negative_horizontal = _mm256_slli_epi32(negative_horizontal, 1);
+            positive_vertical = _mm256_or_si256(negative_horizontal, _mm256_andnot_si256(_mm256_or_si256(vertical, positive_horizontal), all_ones));
+            negative_vertical = _mm256_and_si256(positive_horizontal, vertical);
+        }
+        _mm256_storeu_si256((__m256i *)(distances + group), score);
+    }
+}
+#endif
 
-    char corrected_sentence[1024] = ""; // Corrected sentence
-    char original_sentence[1024] = ""; // Original sentence
+typedef void (*LevenshteinBatchFunction)(const LevenshteinQuery *, const char *, size_t, size_t, size_t, uint32_t *);
+LevenshteinBatchFunction levenshtein_batch = levenshtein_batch_scalar;
 
-    for (int i = 0; i < input_word_count; i++) {
-        strcat(original_sentence, input_words[i]);
-        strcat(original_sentence, " "); // Add space between words
-
-        thread_data[i].input_word = input_words[i];
-        thread_data[i].dictionary_words = dictionary_words;
-        thread_data[i].dictionary_size = dict_word_count;
-        thread_data[i].is_word_found = 0;
-        thread_data[i].closest_word = NULL; // Initialize closest_word to NULL
-        thread_data[i].client_fd = client_fd;
-        thread_data[i].word_position = i + 1; // Assign the word position
-
-        if (pthread_create(&threads[i], NULL, thread_function, &thread_data[i]) != 0) {
-            fprintf(stderr, "ERROR: Failed to create thread for word %d.\n", i + 1);
-            return;
-        }
+// Picks the widest batched kernel the CPU supports
+const char *levenshtein_batch_init(void) {
+#ifdef HAVE_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        levenshtein_batch = levenshtein_batch_avx2;
+        return "AVX2";
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        levenshtein_batch = levenshtein_batch_sse2;
+        return "SSE2";
     }
+#endif
+    levenshtein_batch = levenshtein_batch_scalar;
+    return "scalar";
+}
 
-    // Wait for all threads and construct the corrected sentence
-    for (int i = 0; i < input_word_count; i++) {
-        pthread_join(threads[i], NULL);
-        if (!thread_data[i].is_word_found && thread_data[i].closest_word != NULL) {
-            strcat(corrected_sentence, thread_data[i].closest_word);
-        } else {
-            strcat(corrected_sentence, thread_data[i].input_word);
+// Levenshtein distance whatever the query's metric, for the BK-tree, which is
+// built on it
+static inline size_t
+levenshtein_query_edits(const LevenshteinQuery *query, const char *b, const size_t bLength, const size_t max) {
+    if (query->bit_parallel) {
+        const size_t length_difference = query->length > bLength ? query->length - bLength : bLength - query->length;
+        if (length_difference > max) {
+            return max + 1;
         }
-        strcat(corrected_sentence, " ");
+        return levenshtein_myers(query->peq, query->length, b, bLength, max);
     }
+    return levenshtein_bounded(query->word, query->length, b, bLength, max);
+}
 
-    // Send the original and corrected sentences to the client
-    char response_message[1024];
-    snprintf(response_message, sizeof(response_message), "\nINPUT: %s\n", original_sentence);
-    send(client_fd, response_message, strlen(response_message), 0);
-    snprintf(response_message, sizeof(response_message), "OUTPUT: %s\n\n", corrected_sentence);
-    send(client_fd, response_message, strlen(response_message), 0);
-
-    // Send the farewell message
-    const char *farewell_message = "Thank you for using Text Analysis Server! Good Bye!\n";
-    send(client_fd, farewell_message, strlen(farewell_message), 0);
+// Distance in the query's metric, exact when at most max
+static inline size_t
+levenshtein_query_bounded(const LevenshteinQuery *query, const char *b, const size_t bLength, const size_t max) {
+    if (!query->transpositions) {
+        return levenshtein_query_edits(query, b, bLength, max);
+    }
+    if (query->bit_parallel) {
+        const size_t length_difference = query->length > bLength ? query->length - bLength : bLength - query->length;
+        if (length_difference > max) {
+            return max + 1;
+        }
+        return osa_myers(query->peq, query->length, b, bLength, max);
+    }
+    return osa_bounded(query->word, query->length, b, bLength, max);
+}
 
-    // Free allocated memory
-    for (int i = 0; i < input_word_count; i++) {
-        free(input_words[i]);
+static inline const char *dictionary_word(const Dictionary *dictionary, int index) {
+    if (index < dictionary->word_count) {
+        return dictionary->arena + dictionary->offsets[index];
     }
-    free(input_words);
-    exit(1);
+    return dictionary->overlay_words + (size_t)(index - dictionary->word_count) * WORD_LENGTH;
 }
 
+static inline size_t dictionary_word_length(const Dictionary *dictionary, int index) {
+    if (index < dictionary->word_count) {
+        return dictionary->lengths[index];
+    }
+    return dictionary->overlay_lengths[index - dictionary->word_count];
+}
 
-void handle_client(int client_fd) {
-    const char *welcome_message = "\nType 'exit' to disconnect. Type 'shutdown' to stop the server.\n\nHello, this is Text Analysis Server! \n\nPlease enter your input string:\n";
-    send(client_fd, welcome_message, strlen(welcome_message), 0);
+// Added words have no frequency
+static inline uint32_t dictionary_word_frequency(const Dictionary *dictionary, int index) {
+    return index < dictionary->word_count ? dictionary->frequencies[index] : 0;
+}
 
-    char buffer[1024];
+// Words in the snapshot, indexed ones and added ones
+static inline int dictionary_size(const Dictionary *dictionary) {
+    return dictionary->word_count + dictionary->overlay_count;
+}
 
-    while (1) {
-        int bytes_received = recv(client_fd, buffer, sizeof(buffer) - 1, 0);
-        if (bytes_received <= 0) {
-            printf("Client disconnected.\n");
-            break;
-        }
+int file_operations(const char *dictionary_file, Dictionary *dictionary) {
+    FILE *file;
+    char buffer[WORD_LENGTH];
 
-        buffer[bytes_received] = '\0';
-        printf("Client says: %s", buffer);
+    file = fopen(dictionary_file, "r");
+    if (file == NULL) {
+        fprintf(stderr, "ERROR: Dictionary file \"%s\" not found!\n", dictionary_file);
+        return -1;
+    }
 
-        // Shutdown command handling
-        if (strncmp(buffer, "shutdown", 8) == 0) {
-            const char *shutdown_message = "Shutting down the server...\n";
-            send(client_fd, shutdown_message, strlen(shutdown_message), 0);
-            close(client_fd);
-            exit(0); // Exit the server
+    // Each word may be followed by its frequency ("the 23135851162"); words
+    // are alphabetic, so a number always belongs to the word before it
+    int first_word = dictionary->word_count;
+    while (fscanf(file, "%49s", buffer) != EOF) {
+        if (isdigit((unsigned char)buffer[0]) && dictionary->word_count > first_word) {
+            unsigned long long frequency = strtoull(buffer, NULL, 10);
+            dictionary->frequencies[dictionary->word_count - 1] = frequency > UINT32_MAX ? UINT32_MAX : (uint32_t)frequency;
+            continue;
         }
-
-        // Exit command handling
-        if (strncmp(buffer, "exit", 4) == 0) {
-            const char *goodbye_message = "Goodbye!\n";
-            send(client_fd, goodbye_message, strlen(goodbye_message), 0);
-            break;
+        if (dictionary_append(dictionary, buffer, strlen(buffer), 0) != 0) {
+            fclose(file);
+            return -1;
         }
+    }
 
-        // Remove trailing newline or carriage return
-        buffer[strcspn(buffer, "\r\n")] = '\0';
-
-        // Check for input length violation
-        if (strlen(buffer) > INPUT_CHARACTER_LIMIT) {
-            char error_message[1024];
-            snprintf(error_message, sizeof(error_message), "ERROR: Input string is longer than %d characters (INPUT_CHARACTER_LIMIT)!\n", INPUT_CHARACTER_LIMIT);
-            send(client_fd, error_message, strlen(error_message), 0);
-            close(client_fd); // Close connection
-            exit(EXIT_FAILURE); // Shut down the server
+    fclose(file);
+    return 0;
+}
 
+// Appends a word to a dictionary that has not been published yet.
+int dictionary_append(Dictionary *dictionary, const char *word, size_t length, uint32_t frequency) {
+    if (dictionary->word_count >= dictionary->word_capacity) {
+        int capacity = dictionary->word_capacity > 0 ? dictionary->word_capacity * 2 : 1024;
+        uint32_t *offsets = (uint32_t *)realloc(dictionary->offsets, capacity * sizeof(uint32_t));
+        if (offsets == NULL) {
+            fprintf(stderr, "ERROR: Memory reallocation failed.\n");
+            return -1;
         }
+        dictionary->offsets = offsets;
 
-        // Check for unsupported characters
-        for (int i = 0; buffer[i] != '\0'; i++) {
-            if (!isalpha(buffer[i]) && !isspace(buffer[i])) {
-                const char *error_message = "ERROR: Input string contains unsupported characters!\n";
-                send(client_fd, error_message, strlen(error_message), 0);
-                close(client_fd); // Close connection
-                exit(EXIT_FAILURE); // Shut down the server
-            }
+        uint8_t *lengths = (uint8_t *)realloc(dictionary->lengths, capacity * sizeof(uint8_t));
+        if (lengths == NULL) {
+            fprintf(stderr, "ERROR: Memory reallocation failed.\n");
+            return -1;
         }
+        dictionary->lengths = lengths;
 
-        // Process and send words
-        process_and_send_words(client_fd, buffer, NULL, 0);
+        uint32_t *frequencies = (uint32_t *)realloc(dictionary->frequencies, capacity * sizeof(uint32_t));
+        if (frequencies == NULL) {
+            fprintf(stderr, "ERROR: Memory reallocation failed.\n");
+            return -1;
+        }
+        dictionary->frequencies = frequencies;
+        dictionary->word_capacity = capacity;
+    }
 
-        close(client_fd); // Close connection after processing the sentence
-        return; // End communication
+    if (dictionary->arena_size + length + 1 > dictionary->arena_capacity) {
+        size_t capacity = dictionary->arena_capacity > 0 ? dictionary->arena_capacity : 8192;
+        while (dictionary->arena_size + length + 1 > capacity) {
+            capacity *= 2;
+        }
+        char *arena = (char *)realloc(dictionary->arena, capacity);
+        if (arena == NULL) {
+            fprintf(stderr, "ERROR: Memory reallocation failed.\n");
+            return -1;
+        }
+        dictionary->arena = arena;
+        dictionary->arena_capacity = capacity;
     }
 
-    close(client_fd);
+    memcpy(dictionary->arena + dictionary->arena_size, word, length);
+    dictionary->arena[dictionary->arena_size + length] = '\0';
+    dictionary->offsets[dictionary->word_count] = (uint32_t)dictionary->arena_size;
+    dictionary->lengths[dictionary->word_count] = (uint8_t)length;
+    dictionary->frequencies[dictionary->word_count] = frequency;
+    dictionary->arena_size += length + 1;
+    dictionary->word_count++;
+    return 0;
 }
 
-
+void dictionary_free(Dictionary *dictionary) {
+    if (dictionary->base != NULL) {
+        dictionary_release(dictionary->base);
+        free(dictionary);
+        return;
+    }
+    free(dictionary->overlay_words);
+    free(dictionary->overlay_lengths);
+    for (int i = 0; i < dictionary->overlay_retired_count; i++) {
+        free(dictionary->overlay_retired[i]);
+    }
+    free(dictionary->overlay_retired);
+    word_set_free(&dictionary->words);
+    if (dictionary->mapping != NULL) {
+        free(dictionary->deletion_index); // Only the struct, its tables are mapped
+        munmap(dictionary->mapping, dictionary->mapping_size);
+        free(dictionary);
+        return;
+    }
+    free(dictionary->arena);
+    free(dictionary->offsets);
+    free(dictionary->lengths);
+    free(dictionary->frequencies);
+    free(dictionary->length_order);
+    free(dictionary->columns);
+    free(dictionary->bktree);
+    free(dictionary->trie);
+    free(dictionary->trie_words);
+    deletion_index_free(dictionary->deletion_index);
+    free(dictionary);
+}
+
+// Bucket width in words, padded so a bucket is a whole number of SIMD batches
+static inline size_t bucket_stride(const Dictionary *dictionary, int length) {
+    return ((size_t)(dictionary->length_starts[length + 1] - dictionary->length_starts[length]) + 7) & ~(size_t)7;
+}
+
+int dictionary_build_buckets(Dictionary *dictionary) {
+    free(dictionary->length_order);
+    free(dictionary->columns);
+    dictionary->columns = NULL;
+    dictionary->length_order = (uint32_t *)malloc((dictionary->word_count > 0 ? dictionary->word_count : 1) * sizeof(uint32_t));
+    if (dictionary->length_order == NULL) {
+        fprintf(stderr, "ERROR: Memory allocation failed.\n");
+        return -1;
+    }
+
+    // Counting sort by length keeps dictionary order inside each bucket
+    uint32_t counts[WORD_LENGTH] = {0};
+    for (int i = 0; i < dictionary->word_count; i++) {
+        counts[dictionary->lengths[i]]++;
+    }
+    dictionary->length_starts[0] = 0;
+    for (int length = 0; length < WORD_LENGTH; length++) {
+        dictionary->length_starts[length + 1] = dictionary->length_starts[length] + counts[length];
+    }
+    uint32_t next[WORD_LENGTH];
+    memcpy(next, dictionary->length_starts, sizeof(next));
+    for (int i = 0; i < dictionary->word_count; i++) {
+        dictionary->length_order[next[dictionary->lengths[i]]++] = (uint32_t)i;
+    }
+
+    size_t columns_size = 0;
+    for (int length = 0; length < WORD_LENGTH; length++) {
+        dictionary->column_offsets[length] = columns_size;
+        columns_size += (size_t)length * bucket_stride(dictionary, length);
+    }
+    dictionary->columns = (char *)calloc(columns_size > 0 ? columns_size : 1, 1);
+    if (dictionary->columns == NULL) {
+        fprintf(stderr, "ERROR: Memory allocation failed.\n");
+        return -1;
+    }
+    for (int length = 1; length < WORD_LENGTH; length++) {
+        size_t stride = bucket_stride(dictionary, length);
+        char *column = dictionary->columns + dictionary->column_offsets[length];
+        for (uint32_t lane = 0; lane < dictionary->length_starts[length + 1] - dictionary->length_starts[length]; lane++) {
+            const char *word = dictionary_word(dictionary, dictionary->length_order[dictionary->length_starts[length] + lane]);
+            for (int j = 0; j < length; j++) {
+                column[j * stride + lane] = word[j];
+            }
+        }
+    }
+    return 0;
+}
+
+int bktree_build(Dictionary *dictionary) {
+    dictionary->bktree = (BKTreeNode *)calloc(dictionary->word_count > 0 ? dictionary->word_count : 1, sizeof(BKTreeNode));
+    if (dictionary->bktree == NULL) {
+        fprintf(stderr, "ERROR: Memory allocation failed.\n");
+        return -1;
+    }
+
+    for (int i = 1; i < dictionary->word_count; i++) {
+        bktree_insert(dictionary, i);
+    }
+    return 0;
+}
+
+// Links word index below the root; dictionary->bktree must have room for it.
+// Duplicate words become children at distance 0 so they are still reported.
+void bktree_insert(Dictionary *dictionary, int index) {
+    BKTreeNode *nodes = dictionary->bktree;
+    const char *word = dictionary_word(dictionary, index);
+    size_t length = dictionary->lengths[index];
+
+    nodes[index].first_child = 0;
+    nodes[index].next_sibling = 0;
+    if (index == 0) {
+        return;
+    }
+
+    uint32_t node = 0;
+    while (1) {
+        uint32_t distance = (uint32_t)levenshtein_n(word, length, dictionary_word(dictionary, node), dictionary->lengths[node]);
+        uint32_t child = nodes[node].first_child;
+        while (child != 0 && nodes[child].distance != distance) {
+            child = nodes[child].next_sibling;
+        }
+
+        if (child == 0) {
+            nodes[index].distance = distance;
+            nodes[index].next_sibling = nodes[node].first_child;
+            nodes[node].first_child = (uint32_t)index;
+            return;
+        }
+        node = child;
+    }
+}
+
+typedef struct {
+    const char *word;
+    uint32_t length;
+    uint32_t frequency;
+    uint32_t index;
+} TrieEntry;
+
+// Orders words so that every prefix comes before the words extending it and
+// equal words as a search ranks them, by falling frequency and then position
+static int compare_trie_entries(const void *a, const void *b) {
+    const TrieEntry *left = (const TrieEntry *)a;
+    const TrieEntry *right = (const TrieEntry *)b;
+    int order = memcmp(left->word, right->word, left->length < right->length ? left->length : right->length);
+    if (order != 0) {
+        return order;
+    }
+    if (left->length != right->length) {
+        return left->length < right->length ? -1 : 1;
+    }
+    if (left->frequency != right->frequency) {
+        return left->frequency > right->frequency ? -1 : 1;
+    }
+    return (left->index > right->index) - (left->index < right->index);
+}
+
+// Builds the trie from the sorted words. Each node covers a range of them
+// sharing its prefix; its children are appended in order as it is visited,
+// so the node array is also the breadth-first work queue.
+int trie_build(Dictionary *dictionary) {
+    size_t word_count = (size_t)dictionary->word_count;
+    size_t capacity = 1;
+    for (size_t i = 0; i < word_count; i++) {
+        capacity += dictionary->lengths[i];
+    }
+
+    TrieEntry *entries = (TrieEntry *)malloc((word_count > 0 ? word_count : 1) * sizeof(TrieEntry));
+    TrieNode *nodes = (TrieNode *)malloc(capacity * sizeof(TrieNode));
+    uint32_t *ranges = (uint32_t *)malloc(capacity * 2 * sizeof(uint32_t)); // Entries [first, last) below each node
+    uint8_t *depths = (uint8_t *)malloc(capacity);
+    uint32_t *words = (uint32_t *)malloc((word_count > 0 ? word_count : 1) * sizeof(uint32_t));
+    if (entries == NULL || nodes == NULL || ranges == NULL || depths == NULL || words == NULL) {
+        fprintf(stderr, "ERROR: Memory allocation failed.\n");
+        free(entries);
+        free(nodes);
+        free(words);
+        free(ranges);
+        free(depths);
+        return -1;
+    }
+    for (size_t i = 0; i < word_count; i++) {
+        entries[i].word = dictionary_word(dictionary, (int)i);
+        entries[i].length = dictionary->lengths[i];
+        entries[i].frequency = dictionary->frequencies[i];
+        entries[i].index = (uint32_t)i;
+    }
+    qsort(entries, word_count, sizeof(TrieEntry), compare_trie_entries);
+    for (size_t i = 0; i < word_count; i++) {
+        words[i] = entries[i].index;
+    }
+
+    nodes[0] = (TrieNode){0, 0, 0, 0, '\0'};
+    ranges[0] = 0;
+    ranges[1] = (uint32_t)word_count;
+    depths[0] = 0;
+    size_t node_count = 1;
+    for (size_t node = 0; node < node_count; node++) {
+        uint32_t first = ranges[node * 2];
+        uint32_t last = ranges[node * 2 + 1];
+        uint8_t depth = depths[node];
+        nodes[node].first_word = first;
+        while (first < last && entries[first].length == depth) {
+            if (nodes[node].word_count < UINT8_MAX) {
+                nodes[node].word_count++;
+            }
+            first++;
+        }
+
+        nodes[node].first_child = (uint32_t)node_count;
+        nodes[node].child_count = 0;
+        while (first < last) {
+            char character = entries[first].word[depth];
+            uint32_t end = first;
+            while (end < last && entries[end].word[depth] == character) {
+                end++;
+            }
+            nodes[node_count] = (TrieNode){0, 0, 0, 0, character};
+            ranges[node_count * 2] = first;
+            ranges[node_count * 2 + 1] = end;
+            depths[node_count] = depth + 1;
+            node_count++;
+            nodes[node].child_count++;
+            first = end;
+        }
+    }
+    free(entries);
+    free(ranges);
+    free(depths);
+
+    TrieNode *shrunk = (TrieNode *)realloc(nodes, node_count * sizeof(TrieNode));
+    dictionary->trie = shrunk != NULL ? shrunk : nodes;
+    dictionary->trie_node_count = node_count;
+    dictionary->trie_words = words;
+    printf("Trie: %zu nodes for %zu words, %.1f KiB.\n", node_count, word_count, node_count * sizeof(TrieNode) / 1024.0);
+    return 0;
+}
+
+uint64_t delete_hash(const char *word, size_t length) {
+    uint64_t hash = 14695981039346656037ULL; // FNV-1a
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ (unsigned char)word[i]) * 1099511628211ULL;
+    }
+    return hash != 0 ? hash : 1; // 0 marks empty table slots
+}
+
+typedef struct {
+    uint64_t hash;
+    uint32_t word;
+} DeleteEntry;
+
+typedef struct {
+    DeleteEntry *entries;
+    size_t size;
+    size_t capacity;
+} DeleteList;
+
+int delete_list_push(DeleteList *list, uint64_t hash, uint32_t word) {
+    if (list->size == list->capacity) {
+        size_t capacity = list->capacity > 0 ? list->capacity * 2 : 4096;
+        DeleteEntry *entries = (DeleteEntry *)realloc(list->entries, capacity * sizeof(DeleteEntry));
+        if (entries == NULL) {
+            return -1;
+        }
+        list->entries = entries;
+        list->capacity = capacity;
+    }
+    list->entries[list->size].hash = hash;
+    list->entries[list->size].word = word;
+    list->size++;
+    return 0;
+}
+
+// Adds the hash of word and of every string reachable by deleting up to
+// remaining more characters from it. Duplicates are removed by the caller.
+int generate_deletes(const char *word, size_t length, int remaining, uint32_t word_index, DeleteList *list) {
+    if (delete_list_push(list, delete_hash(word, length), word_index) != 0) {
+        return -1;
+    }
+    if (remaining == 0 || length == 0) {
+        return 0;
+    }
+
+    char shorter[WORD_LENGTH + 8];
+    for (size_t i = 0; i < length; i++) {
+        // Deleting either of two equal neighbours gives the same string
+        if (i > 0 && word[i] == word[i - 1]) {
+            continue;
+        }
+        memcpy(shorter, word, i);
+        memcpy(shorter + i, word + i + 1, length - i - 1);
+        if (generate_deletes(shorter, length - 1, remaining - 1, word_index, list) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int compare_delete_entries(const void *a, const void *b) {
+    const DeleteEntry *left = (const DeleteEntry *)a;
+    const DeleteEntry *right = (const DeleteEntry *)b;
+    if (left->hash != right->hash) {
+        return left->hash < right->hash ? -1 : 1;
+    }
+    return (left->word > right->word) - (left->word < right->word);
+}
+
+// Returns the table slot holding hash, or the empty slot where it would go.
+size_t deletion_index_slot(const DeletionIndex *index, uint64_t hash) {
+    size_t mask = index->table_size - 1;
+    size_t slot = (size_t)(hash ^ (hash >> 29)) & mask;
+    while (index->hashes[slot] != 0 && index->hashes[slot] != hash) {
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+void deletion_index_free(DeletionIndex *index) {
+    if (index == NULL) {
+        return;
+    }
+    free(index->hashes);
+    free(index->starts);
+    free(index->counts);
+    free(index->postings);
+    free(index);
+}
+
+size_t deletion_index_memory(const DeletionIndex *index) {
+    return index->table_size * (sizeof(uint64_t) + 2 * sizeof(uint32_t)) + index->posting_count * sizeof(uint32_t);
+}
+
+int deletion_index_build(Dictionary *dictionary) {
+    DeleteList list = {NULL, 0, 0};
+    for (int i = 0; i < dictionary->word_count; i++) {
+        if (generate_deletes(dictionary_word(dictionary, i), dictionary->lengths[i], SYMSPELL_MAX_DISTANCE, (uint32_t)i, &list) != 0) {
+            fprintf(stderr, "ERROR: Memory allocation failed.\n");
+            free(list.entries);
+            return -1;
+        }
+    }
+
+    // Sort by hash so each delete's postings are contiguous, dropping repeats
+    qsort(list.entries, list.size, sizeof(DeleteEntry), compare_delete_entries);
+    size_t unique_entries = 0;
+    size_t delete_count = 0;
+    for (size_t i = 0; i < list.size; i++) {
+        if (unique_entries > 0 && compare_delete_entries(&list.entries[unique_entries - 1], &list.entries[i]) == 0) {
+            continue;
+        }
+        if (unique_entries == 0 || list.entries[unique_entries - 1].hash != list.entries[i].hash) {
+            delete_count++;
+        }
+        list.entries[unique_entries++] = list.entries[i];
+    }
+
+    DeletionIndex *index = (DeletionIndex *)calloc(1, sizeof(DeletionIndex));
+    if (index == NULL) {
+        fprintf(stderr, "ERROR: Memory allocation failed.\n");
+        free(list.entries);
+        return -1;
+    }
+    index->table_size = 16;
+    while (index->table_size < delete_count * 2) {
+        index->table_size *= 2;
+    }
+    index->delete_count = delete_count;
+    index->posting_count = unique_entries;
+    index->max_distance = SYMSPELL_MAX_DISTANCE;
+    index->hashes = (uint64_t *)calloc(index->table_size, sizeof(uint64_t));
+    index->starts = (uint32_t *)malloc(index->table_size * sizeof(uint32_t));
+    index->counts = (uint32_t *)malloc(index->table_size * sizeof(uint32_t));
+    index->postings = (uint32_t *)malloc((unique_entries > 0 ? unique_entries : 1) * sizeof(uint32_t));
+    if (index->hashes == NULL || index->starts == NULL || index->counts == NULL || index->postings == NULL) {
+        fprintf(stderr, "ERROR: Memory allocation failed.\n");
+        deletion_index_free(index);
+        free(list.entries);
+        return -1;
+    }
+
+    for (size_t i = 0; i < unique_entries; i++) {
+        index->postings[i] = list.entries[i].word;
+        size_t slot = deletion_index_slot(index, list.entries[i].hash);
+        if (index->hashes[slot] == 0) {
+            index->hashes[slot] = list.entries[i].hash;
+            index->starts[slot] = (uint32_t)i;
+            index->counts[slot] = 0;
+        }
+        index->counts[slot]++;
+    }
+    free(list.entries);
+
+    dictionary->deletion_index = index;
+    printf("Deletion index: %zu deletes, %zu postings, %.1f KiB (max distance %d).\n",
+           index->delete_count, index->posting_count, deletion_index_memory(index) / 1024.0, index->max_distance);
+    return 0;
+}
+
+void word_set_free(WordSet *set) {
+    free(set->slots);
+    set->slots = NULL;
+}
+
+// Returns the slot holding the word, or the empty slot where it would go
+static size_t word_set_slot(const WordSet *set, const Dictionary *dictionary, const char *word, size_t length) {
+    size_t slot = (size_t)delete_hash(word, length) & set->mask;
+    while (set->slots[slot] != -1) {
+        int index = set->slots[slot];
+        if (dictionary_word_length(dictionary, index) == length && memcmp(dictionary_word(dictionary, index), word, length) == 0) {
+            break;
+        }
+        slot = (slot + 1) & set->mask;
+    }
+    return slot;
+}
+
+int word_set_find(const WordSet *set, const Dictionary *dictionary, const char *word, size_t length) {
+    return set->slots[word_set_slot(set, dictionary, word, length)];
+}
+
+// Adds word index of dictionary, growing the table to stay at most half full
+int word_set_insert(WordSet *set, const Dictionary *dictionary, int index) {
+    if (set->slots == NULL || (set->count + 1) * 2 > set->mask + 1) {
+        size_t size = set->slots != NULL ? (set->mask + 1) * 2 : 1024;
+        int *old_slots = set->slots;
+        size_t old_size = set->slots != NULL ? set->mask + 1 : 0;
+        set->slots = (int *)malloc(size * sizeof(int));
+        if (set->slots == NULL) {
+            set->slots = old_slots;
+            fprintf(stderr, "ERROR: Memory allocation failed.\n");
+            return -1;
+        }
+        memset(set->slots, 0xff, size * sizeof(int));
+        set->mask = size - 1;
+        for (size_t i = 0; i < old_size; i++) {
+            if (old_slots[i] != -1) {
+                int moved = old_slots[i];
+                set->slots[word_set_slot(set, dictionary, dictionary_word(dictionary, moved), dictionary_word_length(dictionary, moved))] = moved;
+            }
+        }
+        free(old_slots);
+    }
+
+    size_t slot = word_set_slot(set, dictionary, dictionary_word(dictionary, index), dictionary_word_length(dictionary, index));
+    if (set->slots[slot] == -1) {
+        set->slots[slot] = index;
+        set->count++;
+    }
+    return 0;
+}
+
+// Builds the exact-match set over the indexed words; a word listed twice
+// keeps the index a search would rank first, the most frequent and then the
+// first one
+int dictionary_build_word_set(Dictionary *dictionary) {
+    WordSet *set = &dictionary->words;
+    word_set_free(set);
+    set->count = 0;
+    for (int i = 0; i < dictionary->word_count; i++) {
+        if (set->slots != NULL) {
+            size_t slot = word_set_slot(set, dictionary, dictionary_word(dictionary, i), dictionary->lengths[i]);
+            if (set->slots[slot] != -1) {
+                if (dictionary->frequencies[i] > dictionary->frequencies[set->slots[slot]]) {
+                    set->slots[slot] = i;
+                }
+                continue;
+            }
+        }
+        if (word_set_insert(set, dictionary, i) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Builds the search index required by SEARCH_ENGINE.
+int dictionary_build_index(Dictionary *dictionary) {
+    if (dictionary_build_word_set(dictionary) != 0) {
+        return -1;
+    }
+    switch (SEARCH_ENGINE) {
+        case ENGINE_BKTREE:
+            return bktree_build(dictionary);
+        case ENGINE_DELETES:
+            return deletion_index_build(dictionary);
+        case ENGINE_TRIE:
+            return trie_build(dictionary);
+        default:
+            return 0;
+    }
+}
+
+static size_t dictionary_columns_size(const Dictionary *dictionary) {
+    return dictionary->column_offsets[WORD_LENGTH - 1] + (size_t)(WORD_LENGTH - 1) * bucket_stride(dictionary, WORD_LENGTH - 1);
+}
+
+// Writes one section at the next aligned offset and records it in the header
+static int dictionary_write_section(FILE *file, DictionaryFileHeader *header, int section, const void *data, size_t size) {
+    static const char padding[DICTIONARY_SECTION_ALIGNMENT] = {0};
+    long position = ftell(file);
+    if (position < 0) {
+        return -1;
+    }
+    size_t pad = (DICTIONARY_SECTION_ALIGNMENT - (size_t)position % DICTIONARY_SECTION_ALIGNMENT) % DICTIONARY_SECTION_ALIGNMENT;
+    if (fwrite(padding, 1, pad, file) != pad || (size > 0 && fwrite(data, 1, size, file) != size)) {
+        return -1;
+    }
+    header->sections[section].offset = (uint64_t)position + pad;
+    header->sections[section].size = size;
+    return 0;
+}
+
+// Compiles a loaded dictionary into output_file. The file is written next to
+// its destination and renamed over it, so running servers that have the old
+// one mapped keep a consistent copy.
+int dictionary_compile(const Dictionary *dictionary, const char *source_file, const char *output_file) {
+    DictionaryFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "TASDICT", 8);
+    header.version = DICTIONARY_FORMAT_VERSION;
+    header.byte_order = 0x01020304;
+    header.word_length = WORD_LENGTH;
+    header.engine = (uint32_t)SEARCH_ENGINE;
+    header.word_count = (uint32_t)dictionary->word_count;
+    struct stat source_stat;
+    if (stat(source_file, &source_stat) == 0) {
+        header.source_mtime = (int64_t)source_stat.st_mtime;
+        header.source_size = (uint64_t)source_stat.st_size;
+    }
+    memcpy(header.length_starts, dictionary->length_starts, sizeof(header.length_starts));
+    for (int length = 0; length < WORD_LENGTH; length++) {
+        header.column_offsets[length] = dictionary->column_offsets[length];
+    }
+
+    char temporary_file[PATH_MAX];
+    snprintf(temporary_file, sizeof(temporary_file), "%s.tmp", output_file);
+    FILE *file = fopen(temporary_file, "wb");
+    if (file == NULL) {
+        fprintf(stderr, "ERROR: Cannot create \"%s\": %s\n", temporary_file, strerror(errno));
+        return -1;
+    }
+
+    size_t word_count = (size_t)dictionary->word_count;
+    const DeletionIndex *index = dictionary->deletion_index;
+    int failed = fwrite(&header, sizeof(header), 1, file) != 1
+        || dictionary_write_section(file, &header, SECTION_ARENA, dictionary->arena, dictionary->arena_size)
+        || dictionary_write_section(file, &header, SECTION_OFFSETS, dictionary->offsets, word_count * sizeof(uint32_t))
+        || dictionary_write_section(file, &header, SECTION_LENGTHS, dictionary->lengths, word_count * sizeof(uint8_t))
+        || dictionary_write_section(file, &header, SECTION_FREQUENCIES, dictionary->frequencies, word_count * sizeof(uint32_t))
+        || dictionary_write_section(file, &header, SECTION_LENGTH_ORDER, dictionary->length_order, word_count * sizeof(uint32_t))
+        || dictionary_write_section(file, &header, SECTION_COLUMNS, dictionary->columns, dictionary_columns_size(dictionary));
+    if (!failed && dictionary->bktree != NULL) {
+        failed = dictionary_write_section(file, &header, SECTION_BKTREE, dictionary->bktree, word_count * sizeof(BKTreeNode));
+    }
+    if (!failed && index != NULL) {
+        header.max_distance = (uint32_t)index->max_distance;
+        header.delete_table_size = index->table_size;
+        header.delete_count = index->delete_count;
+        failed = dictionary_write_section(file, &header, SECTION_DELETE_HASHES, index->hashes, index->table_size * sizeof(uint64_t))
+            || dictionary_write_section(file, &header, SECTION_DELETE_STARTS, index->starts, index->table_size * sizeof(uint32_t))
+            || dictionary_write_section(file, &header, SECTION_DELETE_COUNTS, index->counts, index->table_size * sizeof(uint32_t))
+            || dictionary_write_section(file, &header, SECTION_DELETE_POSTINGS, index->postings, index->posting_count * sizeof(uint32_t));
+    }
+    if (!failed && dictionary->trie != NULL) {
+        failed = dictionary_write_section(file, &header, SECTION_TRIE, dictionary->trie, dictionary->trie_node_count * sizeof(TrieNode))
+            || dictionary_write_section(file, &header, SECTION_TRIE_WORDS, dictionary->trie_words, word_count * sizeof(uint32_t));
+    }
+    // The section table is only known now, rewrite the header
+    if (!failed) {
+        failed = fseek(file, 0, SEEK_SET) != 0 || fwrite(&header, sizeof(header), 1, file) != 1
+            || fflush(file) != 0 || fsync(fileno(file)) != 0;
+    }
+    if (fclose(file) != 0 || failed || rename(temporary_file, output_file) != 0) {
+        fprintf(stderr, "ERROR: Failed to write \"%s\": %s\n", output_file, strerror(errno));
+        unlink(temporary_file);
+        return -1;
+    }
+    return 0;
+}
+
+static bool dictionary_section_valid(const DictionaryFileHeader *header, int section, size_t expected_size, size_t file_size) {
+    const DictionarySection *entry = &header->sections[section];
+    return entry->size == expected_size
+        && entry->offset % DICTIONARY_SECTION_ALIGNMENT == 0
+        && entry->offset <= file_size && entry->size <= file_size - entry->offset;
+}
+
+// Checks once, when the file is mapped, that every index stored in the arrays
+// stays inside them, so a damaged file cannot make a search read out of
+// bounds or walk in circles.
+static bool dictionary_mapped_arrays_valid(const Dictionary *dictionary) {
+    size_t word_count = (size_t)dictionary->word_count;
+    for (size_t i = 0; i < word_count; i++) {
+        size_t offset = dictionary->offsets[i];
+        size_t length = dictionary->lengths[i];
+        if (length >= WORD_LENGTH || offset >= dictionary->arena_size || length >= dictionary->arena_size - offset
+            || dictionary->arena[offset + length] != '\0') {
+            return false;
+        }
+    }
+
+    // Buckets follow each other, hold words of their length, and their columns
+    // are laid out as dictionary_build_buckets does
+    size_t columns_size = 0;
+    for (int length = 0; length < WORD_LENGTH; length++) {
+        uint32_t start = dictionary->length_starts[length];
+        uint32_t end = dictionary->length_starts[length + 1];
+        if ((length == 0 && start != 0) || end < start || end > word_count || dictionary->column_offsets[length] != columns_size) {
+            return false;
+        }
+        for (uint32_t position = start; position < end; position++) {
+            uint32_t word = dictionary->length_order[position];
+            if (word >= word_count || dictionary->lengths[word] != length) {
+                return false;
+            }
+        }
+        columns_size += (size_t)length * bucket_stride(dictionary, length);
+    }
+
+    if (dictionary->bktree != NULL) {
+        // 0 ends a list and is the root. Linking every other node at most once
+        // keeps the walk from the root free of cycles.
+        uint8_t *linked = (uint8_t *)calloc(word_count > 0 ? word_count : 1, 1);
+        if (linked == NULL) {
+            fprintf(stderr, "ERROR: Memory allocation failed.\n");
+            return false;
+        }
+        bool valid = true;
+        for (size_t i = 0; valid && i < word_count; i++) {
+            uint32_t links[2] = {dictionary->bktree[i].first_child, dictionary->bktree[i].next_sibling};
+            for (int j = 0; valid && j < 2; j++) {
+                if (links[j] != 0) {
+                    valid = links[j] < word_count && !linked[links[j]];
+                    if (valid) {
+                        linked[links[j]] = 1;
+                    }
+                }
+            }
+        }
+        free(linked);
+        if (!valid) {
+            return false;
+        }
+    }
+
+    if (dictionary->trie != NULL) {
+        size_t node_count = dictionary->trie_node_count;
+        for (size_t i = 0; i < node_count; i++) {
+            const TrieNode *node = &dictionary->trie[i];
+            // Breadth-first layout: children come after their parent
+            if ((node->child_count > 0 && (node->first_child <= i || (size_t)node->first_child + node->child_count > node_count))
+                || (size_t)node->first_word + node->word_count > word_count) {
+                return false;
+            }
+        }
+        for (size_t i = 0; i < word_count; i++) {
+            if (dictionary->trie_words[i] >= word_count) {
+                return false;
+            }
+        }
+    }
+
+    const DeletionIndex *index = dictionary->deletion_index;
+    if (index != NULL) {
+        bool empty_slot = false;
+        for (size_t slot = 0; slot < index->table_size; slot++) {
+            if (index->hashes[slot] == 0) {
+                empty_slot = true;
+            } else if (index->starts[slot] > index->posting_count || index->counts[slot] > index->posting_count - index->starts[slot]) {
+                return false;
+            }
+        }
+        if (!empty_slot) {
+            return false; // Probing for a delete that is not there would never stop
+        }
+        for (size_t i = 0; i < index->posting_count; i++) {
+            if (index->postings[i] >= word_count) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// Maps a compiled dictionary read-only. Returns NULL, leaving the caller to
+// parse the text file, when the compiled file is missing, was built with other
+// settings or is older than source_file.
+Dictionary *dictionary_map(const char *binary_file, const char *source_file) {
+    int fd = open(binary_file, O_RDONLY);
+    if (fd == -1) {
+        fprintf(stderr, "ERROR: Cannot open compiled dictionary \"%s\": %s\n", binary_file, strerror(errno));
+        return NULL;
+    }
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0 || (size_t)file_stat.st_size < sizeof(DictionaryFileHeader)) {
+        fprintf(stderr, "ERROR: \"%s\" is not a compiled dictionary.\n", binary_file);
+        close(fd);
+        return NULL;
+    }
+    size_t file_size = (size_t)file_stat.st_size;
+    void *mapping = mmap(NULL, file_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd); // The mapping keeps the file referenced
+    if (mapping == MAP_FAILED) {
+        fprintf(stderr, "ERROR: Cannot map \"%s\": %s\n", binary_file, strerror(errno));
+        return NULL;
+    }
+
+    const DictionaryFileHeader *header = (const DictionaryFileHeader *)mapping;
+    const char *reason = NULL;
+    struct stat source_stat;
+    if (memcmp(header->magic, "TASDICT", 8) != 0 || header->version != DICTIONARY_FORMAT_VERSION
+        || header->byte_order != 0x01020304 || header->word_length != WORD_LENGTH) {
+        reason = "has an unsupported format";
+    } else if (header->engine != (uint32_t)SEARCH_ENGINE
+               || (SEARCH_ENGINE == ENGINE_DELETES && header->max_distance != (uint32_t)SYMSPELL_MAX_DISTANCE)) {
+        reason = "was compiled for another engine";
+    } else if (stat(source_file, &source_stat) != 0 || header->source_mtime != (int64_t)source_stat.st_mtime
+               || header->source_size != (uint64_t)source_stat.st_size) {
+        reason = "is older than the word list";
+    }
+
+    Dictionary *dictionary = NULL;
+    if (reason == NULL) {
+        dictionary = (Dictionary *)calloc(1, sizeof(Dictionary));
+        if (dictionary == NULL) {
+            fprintf(stderr, "ERROR: Memory allocation failed.\n");
+            munmap(mapping, file_size);
+            return NULL;
+        }
+        dictionary->word_count = (int)header->word_count;
+        dictionary->word_capacity = dictionary->word_count;
+        memcpy(dictionary->length_starts, header->length_starts, sizeof(dictionary->length_starts));
+        for (int length = 0; length < WORD_LENGTH; length++) {
+            dictionary->column_offsets[length] = (size_t)header->column_offsets[length];
+        }
+
+        size_t word_count = header->word_count;
+        size_t table_size = header->delete_table_size;
+        const DictionarySection *sections = header->sections;
+        bool valid = dictionary_section_valid(header, SECTION_ARENA, sections[SECTION_ARENA].size, file_size)
+            && dictionary_section_valid(header, SECTION_OFFSETS, word_count * sizeof(uint32_t), file_size)
+            && dictionary_section_valid(header, SECTION_LENGTHS, word_count * sizeof(uint8_t), file_size)
+            && dictionary_section_valid(header, SECTION_FREQUENCIES, word_count * sizeof(uint32_t), file_size)
+            && dictionary_section_valid(header, SECTION_LENGTH_ORDER, word_count * sizeof(uint32_t), file_size)
+            && header->length_starts[WORD_LENGTH] == word_count
+            && dictionary_section_valid(header, SECTION_COLUMNS, dictionary_columns_size(dictionary), file_size)
+            && dictionary_section_valid(header, SECTION_BKTREE, SEARCH_ENGINE == ENGINE_BKTREE ? word_count * sizeof(BKTreeNode) : 0, file_size);
+        if (valid && SEARCH_ENGINE == ENGINE_DELETES) {
+            valid = table_size > 0 && (table_size & (table_size - 1)) == 0
+                && dictionary_section_valid(header, SECTION_DELETE_HASHES, table_size * sizeof(uint64_t), file_size)
+                && dictionary_section_valid(header, SECTION_DELETE_STARTS, table_size * sizeof(uint32_t), file_size)
+                && dictionary_section_valid(header, SECTION_DELETE_COUNTS, table_size * sizeof(uint32_t), file_size)
+                && sections[SECTION_DELETE_POSTINGS].size % sizeof(uint32_t) == 0
+                && dictionary_section_valid(header, SECTION_DELETE_POSTINGS, sections[SECTION_DELETE_POSTINGS].size, file_size);
+        }
+        if (valid && SEARCH_ENGINE == ENGINE_TRIE) {
+            valid = sections[SECTION_TRIE].size >= sizeof(TrieNode) && sections[SECTION_TRIE].size % sizeof(TrieNode) == 0
+                && dictionary_section_valid(header, SECTION_TRIE, sections[SECTION_TRIE].size, file_size)
+                && dictionary_section_valid(header, SECTION_TRIE_WORDS, word_count * sizeof(uint32_t), file_size);
+        }
+        if (!valid) {
+            free(dictionary);
+            dictionary = NULL;
+            reason = "is damaged";
+        }
+    }
+    if (reason != NULL) {
+        printf("Compiled dictionary \"%s\" %s, loading \"%s\" instead.\n", binary_file, reason, source_file);
+        munmap(mapping, file_size);
+        return NULL;
+    }
+
+    // The arrays stay in the page cache, shared with other servers mapping the file
+    char *base = (char *)mapping;
+    const DictionarySection *sections = header->sections;
+    dictionary->arena = base + sections[SECTION_ARENA].offset;
+    dictionary->arena_size = sections[SECTION_ARENA].size;
+    dictionary->arena_capacity = dictionary->arena_size;
+    dictionary->offsets = (uint32_t *)(base + sections[SECTION_OFFSETS].offset);
+    dictionary->lengths = (uint8_t *)(base + sections[SECTION_LENGTHS].offset);
+    dictionary->frequencies = (uint32_t *)(base + sections[SECTION_FREQUENCIES].offset);
+    dictionary->length_order = (uint32_t *)(base + sections[SECTION_LENGTH_ORDER].offset);
+    dictionary->columns = base + sections[SECTION_COLUMNS].offset;
+    if (SEARCH_ENGINE == ENGINE_BKTREE) {
+        dictionary->bktree = (BKTreeNode *)(base + sections[SECTION_BKTREE].offset);
+    }
+    if (SEARCH_ENGINE == ENGINE_TRIE) {
+        dictionary->trie = (TrieNode *)(base + sections[SECTION_TRIE].offset);
+        dictionary->trie_node_count = sections[SECTION_TRIE].size / sizeof(TrieNode);
+        dictionary->trie_words = (uint32_t *)(base + sections[SECTION_TRIE_WORDS].offset);
+    }
+    if (SEARCH_ENGINE == ENGINE_DELETES) {
+        DeletionIndex *index = (DeletionIndex *)calloc(1, sizeof(DeletionIndex));
+        if (index == NULL) {
+            fprintf(stderr, "ERROR: Memory allocation failed.\n");
+            free(dictionary);
+            munmap(mapping, file_size);
+            return NULL;
+        }
+        index->hashes = (uint64_t *)(base + sections[SECTION_DELETE_HASHES].offset);
+        index->starts = (uint32_t *)(base + sections[SECTION_DELETE_STARTS].offset);
+        index->counts = (uint32_t *)(base + sections[SECTION_DELETE_COUNTS].offset);
+        index->postings = (uint32_t *)(base + sections[SECTION_DELETE_POSTINGS].offset);
+        index->table_size = header->delete_table_size;
+        index->delete_count = header->delete_count;
+        index->posting_count = sections[SECTION_DELETE_POSTINGS].size / sizeof(uint32_t);
+        index->max_distance = (int)header->max_distance;
+        dictionary->deletion_index = index;
+    }
+    dictionary->mapping = mapping;
+    dictionary->mapping_size = file_size;
+    if (!dictionary_mapped_arrays_valid(dictionary)) {
+        printf("Compiled dictionary \"%s\" is damaged, loading \"%s\" instead.\n", binary_file, source_file);
+        dictionary_free(dictionary);
+        return NULL;
+    }
+    if (dictionary_build_word_set(dictionary) != 0) {
+        dictionary_free(dictionary);
+        return NULL;
+    }
+    dictionary->version = atomic_fetch_add(&dictionary_versions, 1) + 1;
+    atomic_init(&dictionary->ref_count, 1);
+    return dictionary;
+}
+
+// Write-ahead log of added words, kept next to the word list as
+// DICTIONARY_FILE ".wal". One record per word, "word<TAB>checksum\n"; reading
+// stops at the first record that does not check out, which is where a crash
+// cut the log off. Additions only queue their record. A writer thread appends
+// everything queued meanwhile and syncs it once (group commit), and now and
+// then folds the log into the word list.
+typedef struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t queued; // Records are waiting for the writer thread
+    pthread_cond_t committed; // The writer thread synced a batch
+    OutputBuffer pending; // Queued records
+    uint64_t queued_records; // Records queued since startup
+    uint64_t committed_records; // Of those, records written and synced
+    uint64_t failed_commits; // Batches that could not be written; their records stay queued
+    int record_count; // Records in the log file
+    int fd;
+} WriteAheadLog;
+
+WriteAheadLog dictionary_log = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER,
+                                {NULL, 0, 0}, 0, 0, 0, 0, -1};
+char dictionary_log_path[PATH_MAX];
+
+static uint32_t wal_checksum(const char *word, size_t length) {
+    return (uint32_t)delete_hash(word, length);
+}
+
+// Reads the log at path and returns the length of its intact part. Logged
+// words that dictionary does not hold yet are appended to it, so a log that
+// was already folded into the word list before a crash replays harmlessly.
+// dictionary may be NULL to only inspect the log.
+size_t wal_scan(const char *path, Dictionary *dictionary, int *record_count) {
+    *record_count = 0;
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        return 0;
+    }
+
+    WordSet known = {NULL, 0, 0};
+    for (int i = 0; dictionary != NULL && i < dictionary->word_count; i++) {
+        if (word_set_insert(&known, dictionary, i) != 0) {
+            word_set_free(&known);
+            fclose(file);
+            return 0;
+        }
+    }
+
+    char line[WORD_LENGTH + 16];
+    size_t valid_length = 0;
+    while (fgets(line, sizeof(line), file) != NULL) {
+        size_t line_length = strlen(line);
+        char *tab = strchr(line, '\t');
+        unsigned int checksum;
+        if (line[line_length - 1] != '\n' || tab == NULL || tab == line || tab - line >= WORD_LENGTH
+            || sscanf(tab + 1, "%8x", &checksum) != 1 || checksum != wal_checksum(line, (size_t)(tab - line))) {
+            break;
+        }
+
+        size_t length = (size_t)(tab - line);
+        if (dictionary != NULL && word_set_find(&known, dictionary, line, length) == -1) {
+            if (dictionary_append(dictionary, line, length, 0) != 0
+                || word_set_insert(&known, dictionary, dictionary->word_count - 1) != 0) {
+                break;
+            }
+        }
+        valid_length += line_length;
+        (*record_count)++;
+    }
+
+    word_set_free(&known);
+    fclose(file);
+    return valid_length;
+}
+
+// Queues the record of an added word; the writer thread makes it durable
+void wal_append(const char *word, size_t length) {
+    pthread_mutex_lock(&dictionary_log.mutex);
+    output_printf(&dictionary_log.pending, "%.*s\t%08x\n", (int)length, word, wal_checksum(word, length));
+    dictionary_log.queued_records++;
+    pthread_cond_signal(&dictionary_log.queued);
+    pthread_mutex_unlock(&dictionary_log.mutex);
+}
+
+// Waits until every record queued so far is on disk. Returns -1 if the writer
+// thread failed to write them meanwhile; they stay queued for its next try.
+int wal_sync(void) {
+    pthread_mutex_lock(&dictionary_log.mutex);
+    uint64_t target = dictionary_log.queued_records;
+    uint64_t failed_commits = dictionary_log.failed_commits;
+    while (dictionary_log.fd != -1 && dictionary_log.committed_records < target
+           && dictionary_log.failed_commits == failed_commits) {
+        pthread_cond_wait(&dictionary_log.committed, &dictionary_log.mutex);
+    }
+    int result = dictionary_log.fd != -1 && dictionary_log.committed_records < target ? -1 : 0;
+    pthread_mutex_unlock(&dictionary_log.mutex);
+    return result;
+}
+
+// Writes and syncs the queued records as one batch. If that fails the log is
+// cut back to where the batch started, so no torn record is left behind, and
+// the batch is queued again. Returns -1 on failure. Writer thread only.
+int wal_commit(void) {
+    pthread_mutex_lock(&dictionary_log.mutex);
+    OutputBuffer batch = dictionary_log.pending;
+    uint64_t records = dictionary_log.queued_records;
+    dictionary_log.pending = (OutputBuffer){NULL, 0, 0};
+    pthread_mutex_unlock(&dictionary_log.mutex);
+
+    off_t offset = 0;
+    bool failed = false;
+    if (batch.length > 0) {
+        offset = lseek(dictionary_log.fd, 0, SEEK_END);
+        if (offset == -1) {
+            perror("ERROR: Failed to seek the dictionary log");
+            failed = true;
+        }
+    }
+    size_t written = 0;
+    while (!failed && written < batch.length) {
+        ssize_t result = write(dictionary_log.fd, batch.data + written, batch.length - written);
+        if (result == -1 && errno == EINTR) {
+            continue;
+        }
+        if (result == -1) {
+            perror("ERROR: Failed to write the dictionary log");
+            failed = true;
+            break;
+        }
+        written += result;
+    }
+    if (!failed && batch.length > 0 && fdatasync(dictionary_log.fd) != 0) {
+        perror("ERROR: Failed to sync the dictionary log");
+        failed = true;
+    }
+    if (failed && offset != -1 && ftruncate(dictionary_log.fd, offset) != 0) {
+        perror("ERROR: Failed to cut the dictionary log back to its last record");
+    }
+
+    pthread_mutex_lock(&dictionary_log.mutex);
+    if (failed) {
+        // Put the batch back in front of the records queued meanwhile
+        output_append(&batch, dictionary_log.pending.data, dictionary_log.pending.length);
+        free(dictionary_log.pending.data);
+        dictionary_log.pending = batch;
+        dictionary_log.failed_commits++;
+    } else {
+        free(batch.data);
+        dictionary_log.record_count += (int)(records - dictionary_log.committed_records);
+        dictionary_log.committed_records = records;
+    }
+    pthread_cond_broadcast(&dictionary_log.committed);
+    pthread_mutex_unlock(&dictionary_log.mutex);
+    return failed ? -1 : 0;
+}
+
+// Makes a rename in the directory holding path durable
+void fsync_parent_directory(const char *path) {
+    char directory[PATH_MAX];
+    const char *slash = strrchr(path, '/');
+    if (slash == NULL) {
+        snprintf(directory, sizeof(directory), ".");
+    } else {
+        snprintf(directory, sizeof(directory), "%.*s", slash == path ? 1 : (int)(slash - path), path);
+    }
+    int fd = open(directory, O_RDONLY);
+    if (fd != -1) {
+        fsync(fd);
+        close(fd);
+    }
+}
+
+// Rewrites the word list with every word of the current snapshot and empties
+// the log. Only taking the snapshot holds the writer mutex; the new list is
+// written, synced and renamed over the old one outside it, so additions go on
+// queueing records meanwhile. Records the snapshot already holds are then
+// dropped from the queue and the log is truncated. A compiled dictionary is
+// rewritten along with the list, as the list it was compiled from is replaced.
+// Writer thread only;
+// skipped while a reload or an addition holds the writer mutex, the next
+// round retries.
+void wal_compact(void) {
+    if (wal_commit() != 0) {
+        return;
+    }
+    if (pthread_mutex_trylock(&dictionary_writer_mutex) != 0) {
+        return;
+    }
+    Dictionary *dictionary = dictionary_acquire();
+    pthread_mutex_lock(&dictionary_log.mutex);
+    size_t covered_length = dictionary_log.pending.length; // Additions log their word after publishing it
+    uint64_t covered_records = dictionary_log.queued_records;
+    pthread_mutex_unlock(&dictionary_log.mutex);
+    pthread_mutex_lock(&dictionary_file_mutex);
+    time_t mtime = dictionary_mtime;
+    bool edited = dictionary_file_mtime(DICTIONARY_FILE) != mtime; // Leave it to the reload
+    pthread_mutex_unlock(&dictionary_file_mutex);
+    pthread_mutex_unlock(&dictionary_writer_mutex);
+    if (edited) {
+        dictionary_release(dictionary);
+        return;
+    }
+
+    char temporary_file[PATH_MAX];
+    snprintf(temporary_file, sizeof(temporary_file), "%s.tmp", DICTIONARY_FILE);
+    FILE *file = fopen(temporary_file, "w");
+    bool failed = file == NULL;
+    for (int i = 0; !failed && i < dictionary_size(dictionary); i++) {
+        uint32_t frequency = dictionary_word_frequency(dictionary, i);
+        failed = (frequency > 0 ? fprintf(file, "%s %u\n", dictionary_word(dictionary, i), frequency)
+                                : fprintf(file, "%s\n", dictionary_word(dictionary, i))) < 0;
+    }
+    if (file != NULL) {
+        failed = fflush(file) != 0 || fsync(fileno(file)) != 0 || failed;
+        failed = fclose(file) != 0 || failed;
+    }
+    Dictionary *compiled = NULL;
+    if (!failed && DICTIONARY_BINARY != NULL) {
+        compiled = dictionary->overlay_count > 0 ? dictionary_compact(dictionary) : dictionary;
+    }
+
+    // A reload reads the file and then the log, neither may change in between
+    pthread_mutex_lock(&dictionary_file_mutex);
+    if (!failed && dictionary_file_mtime(DICTIONARY_FILE) != mtime) {
+        unlink(temporary_file); // Edited meanwhile, the reload picks the edit up
+    } else if (!failed && rename(temporary_file, DICTIONARY_FILE) == 0) {
+        fsync_parent_directory(DICTIONARY_FILE);
+        dictionary_mtime = dictionary_file_mtime(DICTIONARY_FILE); // Our own write is not a reason to reload
+        // Compiled after the rename, it records the new list's modification time
+        if (compiled != NULL && dictionary_compile(compiled, DICTIONARY_FILE, DICTIONARY_BINARY) == 0) {
+            printf("Compiled %d words into %s.\n", compiled->word_count, DICTIONARY_BINARY);
+        }
+        bool truncated = ftruncate(dictionary_log.fd, 0) == 0 && fdatasync(dictionary_log.fd) == 0;
+        if (!truncated) {
+            perror("ERROR: Failed to truncate the dictionary log"); // Its records are in the list, replaying them is harmless
+        }
+        printf("Dictionary log folded into %s: %d words.\n", DICTIONARY_FILE, dictionary_size(dictionary));
+
+        pthread_mutex_lock(&dictionary_log.mutex);
+        if (covered_length > 0) {
+            memmove(dictionary_log.pending.data, dictionary_log.pending.data + covered_length,
+                    dictionary_log.pending.length - covered_length);
+            dictionary_log.pending.length -= covered_length;
+        }
+        dictionary_log.committed_records = covered_records;
+        if (truncated) {
+            dictionary_log.record_count = 0;
+        }
+        pthread_cond_broadcast(&dictionary_log.committed);
+        pthread_mutex_unlock(&dictionary_log.mutex);
+    } else {
+        fprintf(stderr, "ERROR: Failed to rewrite \"%s\", keeping the dictionary log.\n", DICTIONARY_FILE);
+        unlink(temporary_file);
+    }
+    pthread_mutex_unlock(&dictionary_file_mutex);
+
+    if (compiled != NULL && compiled != dictionary) {
+        dictionary_free(compiled);
+    }
+    dictionary_release(dictionary);
+}
+
+void *wal_writer(void *arg) {
+    (void)arg;
+    while (1) {
+        pthread_mutex_lock(&dictionary_log.mutex);
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += WAL_COMPACT_SECONDS;
+        int wait_result = 0;
+        while (dictionary_log.pending.length == 0 && wait_result != ETIMEDOUT) {
+            wait_result = pthread_cond_timedwait(&dictionary_log.queued, &dictionary_log.mutex, &deadline);
+        }
+        pthread_mutex_unlock(&dictionary_log.mutex);
+
+        // Records queued while the previous batch was syncing go out together
+        if (wal_commit() != 0) {
+            sleep(1); // The batch is still queued, retry after a pause
+            continue;
+        }
+
+        pthread_mutex_lock(&dictionary_log.mutex);
+        bool compact = dictionary_log.record_count >= WAL_COMPACT_RECORDS
+                       || (wait_result == ETIMEDOUT && dictionary_log.record_count > 0);
+        pthread_mutex_unlock(&dictionary_log.mutex);
+        if (compact) {
+            wal_compact();
+        }
+    }
+    return NULL;
+}
+
+// Opens the log for appending, cutting off a record torn by a crash, and
+// starts the writer thread. The records themselves were replayed by
+// dictionary_load.
+int wal_open(void) {
+    int record_count;
+    size_t valid_length = wal_scan(dictionary_log_path, NULL, &record_count);
+    dictionary_log.fd = open(dictionary_log_path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (dictionary_log.fd == -1 || ftruncate(dictionary_log.fd, (off_t)valid_length) != 0) {
+        fprintf(stderr, "ERROR: Cannot open dictionary log \"%s\": %s\n", dictionary_log_path, strerror(errno));
+        return -1;
+    }
+    dictionary_log.record_count = record_count;
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, wal_writer, NULL) != 0) {
+        fprintf(stderr, "ERROR: Failed to start the dictionary log writer.\n");
+        return -1;
+    }
+    pthread_detach(thread);
+    return 0;
+}
+
+// Loads the dictionary from the compiled file when one is configured and
+// current, otherwise parses the word list, replays the words logged since it
+// was written and builds the index.
+Dictionary *dictionary_load(const char *dictionary_file) {
+    int logged_words = 0;
+    if (DICTIONARY_BINARY != NULL) {
+        wal_scan(dictionary_log_path, NULL, &logged_words);
+        if (logged_words > 0) {
+            // Mapping it would drop the logged words; it is compiled again when the log is folded in
+            fprintf(stderr, "WARNING: Compiled dictionary \"%s\" is stale, %s holds %d added words. Loading \"%s\" instead.\n",
+                    DICTIONARY_BINARY, dictionary_log_path, logged_words, dictionary_file);
+        }
+        Dictionary *mapped = logged_words == 0 ? dictionary_map(DICTIONARY_BINARY, dictionary_file) : NULL;
+        if (mapped != NULL) {
+            return mapped;
+        }
+    }
+
+    Dictionary *dictionary = (Dictionary *)calloc(1, sizeof(Dictionary));
+    if (dictionary == NULL) {
+        fprintf(stderr, "ERROR: Memory allocation failed.\n");
+        return NULL;
+    }
+
+    if (file_operations(dictionary_file, dictionary) != 0) {
+        dictionary_free(dictionary);
+        return NULL;
+    }
+    wal_scan(dictionary_log_path, dictionary, &logged_words);
+    if (logged_words > 0) {
+        printf("Replayed %d added words from %s.\n", logged_words, dictionary_log_path);
+    }
+
+    if (dictionary_build_buckets(dictionary) != 0 || dictionary_build_index(dictionary) != 0) {
+        dictionary_free(dictionary);
+        return NULL;
+    }
+
+    dictionary->version = atomic_fetch_add(&dictionary_versions, 1) + 1;
+    atomic_init(&dictionary->ref_count, 1); // Reference owned by current_dictionary
+    return dictionary;
+}
+
+// Takes a reference to the current snapshot without locking. Must be paired
+// with dictionary_release.
+Dictionary *dictionary_acquire(void) {
+    unsigned epoch = atomic_load(&dictionary_read_epoch) & 1;
+    atomic_fetch_add(&dictionary_readers[epoch], 1);
+
+    Dictionary *dictionary;
+    while (1) {
+        dictionary = atomic_load(&current_dictionary);
+        // A count of 0 means the snapshot was replaced meanwhile and is retired;
+        // it is not freed before this acquire ends, so read the new one
+        int count = atomic_load(&dictionary->ref_count);
+        while (count > 0 && !atomic_compare_exchange_weak(&dictionary->ref_count, &count, count + 1)) {
+        }
+        if (count > 0) {
+            break;
+        }
+    }
+
+    atomic_fetch_sub(&dictionary_readers[epoch], 1);
+    return dictionary;
+}
+
+// Drops a reference. The last one retires the snapshot; dictionary_reclaim frees it.
+void dictionary_release(Dictionary *dictionary) {
+    if (dictionary != NULL && atomic_fetch_sub(&dictionary->ref_count, 1) == 1) {
+        Dictionary *head = atomic_load(&dictionary_retired);
+        do {
+            dictionary->retired_next = head;
+        } while (!atomic_compare_exchange_weak(&dictionary_retired, &head, dictionary));
+    }
+}
+
+// Waits until every dictionary_acquire that started before the call has ended
+void dictionary_synchronize(void) {
+    for (int i = 0; i < 2; i++) {
+        unsigned previous = atomic_fetch_add(&dictionary_read_epoch, 1) & 1;
+        while (atomic_load(&dictionary_readers[previous]) != 0) {
+            sched_yield();
+        }
+    }
+}
+
+// Frees retired snapshots. Called periodically by the maintenance thread.
+void dictionary_reclaim(void) {
+    Dictionary *retired = atomic_exchange(&dictionary_retired, NULL);
+    if (retired == NULL) {
+        return;
+    }
+    dictionary_synchronize();
+    while (retired != NULL) {
+        Dictionary *next = retired->retired_next;
+        dictionary_free(retired); // May retire its base for the next round
+        retired = next;
+    }
+}
+
+// Makes dictionary the current snapshot, taking over the caller's reference.
+void dictionary_publish(Dictionary *dictionary) {
+    Dictionary *old_dictionary = atomic_exchange(&current_dictionary, dictionary);
+    dictionary_release(old_dictionary);
+}
+
+time_t dictionary_file_mtime(const char *dictionary_file) {
+    struct stat file_stat;
+    if (stat(dictionary_file, &file_stat) != 0) {
+        return 0;
+    }
+    return file_stat.st_mtime;
+}
+
+// Reloads the dictionary file on SIGHUP or when its modification time changed.
+// On failure the current snapshot stays in place.
+void dictionary_check_reload(void) {
+    pthread_mutex_lock(&dictionary_writer_mutex);
+    pthread_mutex_lock(&dictionary_file_mutex); // The log writer rewrites the file
+    bool changed = dictionary_file_mtime(DICTIONARY_FILE) != dictionary_mtime;
+    pthread_mutex_unlock(&dictionary_file_mutex);
+    if (!dictionary_reload_requested && !changed) {
+        pthread_mutex_unlock(&dictionary_writer_mutex);
+        return;
+    }
+    // The reloaded dictionary replays the log, it must hold every added word
+    if (wal_sync() != 0) {
+        fprintf(stderr, "ERROR: Dictionary log is not written, postponing the reload.\n");
+        pthread_mutex_unlock(&dictionary_writer_mutex);
+        return;
+    }
+    dictionary_reload_requested = 0;
+    // Not while log compaction swaps the file and empties the log
+    pthread_mutex_lock(&dictionary_file_mutex);
+    time_t mtime = dictionary_file_mtime(DICTIONARY_FILE);
+    Dictionary *dictionary = dictionary_load(DICTIONARY_FILE);
+    if (dictionary != NULL) {
+        dictionary_mtime = mtime;
+    }
+    pthread_mutex_unlock(&dictionary_file_mutex);
+    if (dictionary != NULL) {
+        dictionary_publish(dictionary);
+        printf("Dictionary reloaded: %d words.\n", dictionary_size(dictionary));
+    } else {
+        fprintf(stderr, "ERROR: Dictionary reload failed, keeping the previous dictionary.\n");
+    }
+    pthread_mutex_unlock(&dictionary_writer_mutex);
+}
+
+// Dictionary upkeep that must not stall the event loop: reloads, index
+// rebuilds and freeing retired snapshots. The maintenance thread looks once a
+// second, or sooner when woken.
+pthread_mutex_t maintenance_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t maintenance_wakeup = PTHREAD_COND_INITIALIZER;
+bool maintenance_requested = false;
+
+void dictionary_maintenance_wake(void) {
+    pthread_mutex_lock(&maintenance_mutex);
+    maintenance_requested = true;
+    pthread_cond_signal(&maintenance_wakeup);
+    pthread_mutex_unlock(&maintenance_mutex);
+}
+
+// Writes word into overlay slot of base, a slot no published snapshot counts
+// yet, so readers never see it change. When words come in faster than the
+// index is rebuilt the overlay moves to arrays twice the size; the old ones
+// stay with the base for the snapshots still reading them. Caller holds the
+// writer mutex.
+static int dictionary_overlay_store(Dictionary *base, int slot, const char *word, size_t length) {
+    if (slot >= base->overlay_capacity) {
+        int capacity = base->overlay_capacity > 0 ? base->overlay_capacity * 2
+                                                  : (DICTIONARY_OVERLAY_LIMIT > 0 ? DICTIONARY_OVERLAY_LIMIT : 1);
+        char *words = (char *)malloc((size_t)capacity * WORD_LENGTH);
+        uint8_t *lengths = (uint8_t *)malloc((size_t)capacity);
+        void **retired = base->overlay_words == NULL ? base->overlay_retired
+            : (void **)realloc(base->overlay_retired, (size_t)(base->overlay_retired_count + 2) * sizeof(void *));
+        if (words == NULL || lengths == NULL || (base->overlay_words != NULL && retired == NULL)) {
+            free(words);
+            free(lengths);
+            return -1;
+        }
+        if (base->overlay_words != NULL) {
+            memcpy(words, base->overlay_words, (size_t)slot * WORD_LENGTH);
+            memcpy(lengths, base->overlay_lengths, (size_t)slot);
+            retired[base->overlay_retired_count++] = base->overlay_words;
+            retired[base->overlay_retired_count++] = base->overlay_lengths;
+            base->overlay_retired = retired;
+        }
+        base->overlay_words = words;
+        base->overlay_lengths = lengths;
+        base->overlay_capacity = capacity;
+    }
+    memcpy(base->overlay_words + (size_t)slot * WORD_LENGTH, word, length);
+    base->overlay_words[(size_t)slot * WORD_LENGTH + length] = '\0';
+    base->overlay_lengths[slot] = (uint8_t)length;
+    return 0;
+}
+
+// Returns a snapshot sharing the arrays of base and counting overlay_count of
+// its overlay words, or NULL if out of memory
+static Dictionary *dictionary_snapshot(Dictionary *base, int overlay_count) {
+    Dictionary *dictionary = (Dictionary *)malloc(sizeof(Dictionary));
+    if (dictionary == NULL) {
+        return NULL;
+    }
+    memcpy(dictionary, base, sizeof(Dictionary));
+    dictionary->overlay_count = overlay_count;
+    dictionary->base = base;
+    dictionary->retired_next = NULL;
+    atomic_fetch_add(&base->ref_count, 1);
+    atomic_init(&dictionary->ref_count, 1);
+    return dictionary;
+}
+
+// Builds a new base holding every word of snapshot, overlay included
+Dictionary *dictionary_compact(const Dictionary *snapshot) {
+    Dictionary *dictionary = (Dictionary *)calloc(1, sizeof(Dictionary));
+    if (dictionary == NULL) {
+        return NULL;
+    }
+    for (int i = 0; i < dictionary_size(snapshot); i++) {
+        if (dictionary_append(dictionary, dictionary_word(snapshot, i), dictionary_word_length(snapshot, i),
+                              dictionary_word_frequency(snapshot, i)) != 0) {
+            dictionary_free(dictionary);
+            return NULL;
+        }
+    }
+    if (dictionary_build_buckets(dictionary) != 0 || dictionary_build_index(dictionary) != 0) {
+        dictionary_free(dictionary);
+        return NULL;
+    }
+    dictionary->version = atomic_fetch_add(&dictionary_versions, 1) + 1;
+    atomic_init(&dictionary->ref_count, 1);
+    return dictionary;
+}
+
+// Publishes a new snapshot containing word and logs it for the dictionary file.
+// Lookups are never blocked: they continue on the snapshot they hold. The
+// word goes into the overlay; the index is rebuilt in the background once
+// DICTIONARY_OVERLAY_LIMIT words are waiting there.
+int dictionary_add_word(const char *word, size_t length) {
+    if (length == 0 || length >= WORD_LENGTH) {
+        fprintf(stderr, "ERROR: Words must be shorter than %d characters.\n", WORD_LENGTH);
+        return -1;
+    }
+
+    pthread_mutex_lock(&dictionary_writer_mutex);
+    Dictionary *old_dictionary = dictionary_acquire();
+    // Readers keep going on old_dictionary; a snapshot one word larger shares the rest
+    Dictionary *base = old_dictionary->base != NULL ? old_dictionary->base : old_dictionary;
+    int overlay_count = old_dictionary->overlay_count + 1;
+    Dictionary *dictionary = NULL;
+    if (dictionary_overlay_store(base, overlay_count - 1, word, length) == 0) {
+        dictionary = dictionary_snapshot(base, overlay_count);
+    }
+    dictionary_release(old_dictionary);
+    if (dictionary == NULL) {
+        fprintf(stderr, "ERROR: Memory allocation failed.\n");
+        pthread_mutex_unlock(&dictionary_writer_mutex);
+        return -1;
+    }
+    dictionary_publish(dictionary);
+
+    // Persisted by the log writer thread, off this request's path
+    wal_append(word, length);
+
+    pthread_mutex_unlock(&dictionary_writer_mutex);
+    if (overlay_count >= DICTIONARY_OVERLAY_LIMIT) {
+        dictionary_maintenance_wake();
+    }
+    return 0;
+}
+
+// Folds a full overlay into a new base. The index is built from a snapshot
+// without holding the writer mutex, so lookups and additions go on meanwhile;
+// words added during the build are carried over into the new base's overlay
+// when it is published. Maintenance thread only.
+void dictionary_rebuild(void) {
+    Dictionary *snapshot = dictionary_acquire();
+    if (snapshot->overlay_count == 0 || snapshot->overlay_count < DICTIONARY_OVERLAY_LIMIT) {
+        dictionary_release(snapshot);
+        return;
+    }
+    Dictionary *rebuilt = dictionary_compact(snapshot);
+
+    pthread_mutex_lock(&dictionary_writer_mutex);
+    Dictionary *current = dictionary_acquire();
+    const Dictionary *snapshot_base = snapshot->base != NULL ? snapshot->base : snapshot;
+    const Dictionary *current_base = current->base != NULL ? current->base : current;
+    Dictionary *published = NULL;
+    if (rebuilt != NULL && current_base == snapshot_base) { // A reload did not replace it meanwhile
+        int carried = current->overlay_count - snapshot->overlay_count;
+        bool stored = true;
+        for (int i = 0; stored && i < carried; i++) {
+            int index = current->word_count + snapshot->overlay_count + i;
+            stored = dictionary_overlay_store(rebuilt, i, dictionary_word(current, index), dictionary_word_length(current, index)) == 0;
+        }
+        if (stored) {
+            published = carried > 0 ? dictionary_snapshot(rebuilt, carried) : rebuilt;
+        }
+        if (published == NULL) {
+            fprintf(stderr, "ERROR: Memory allocation failed.\n");
+        }
+    } else if (rebuilt == NULL) {
+        fprintf(stderr, "ERROR: Dictionary index rebuild failed.\n");
+    }
+
+    if (published != NULL) {
+        if (published != rebuilt) {
+            dictionary_release(rebuilt); // The snapshot holds its own reference
+        }
+        dictionary_publish(published);
+        printf("Dictionary index rebuilt: %d words.\n", dictionary_size(published));
+    } else if (rebuilt != NULL) {
+        dictionary_free(rebuilt); // Never published
+    }
+    dictionary_release(current);
+    pthread_mutex_unlock(&dictionary_writer_mutex);
+    dictionary_release(snapshot);
+}
+
+void *dictionary_maintainer(void *arg) {
+    (void)arg;
+    while (1) {
+        pthread_mutex_lock(&maintenance_mutex);
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += 1;
+        int wait_result = 0;
+        while (!maintenance_requested && wait_result != ETIMEDOUT) {
+            wait_result = pthread_cond_timedwait(&maintenance_wakeup, &maintenance_mutex, &deadline);
+        }
+        maintenance_requested = false;
+        pthread_mutex_unlock(&maintenance_mutex);
+
+        dictionary_check_reload();
+        dictionary_rebuild();
+        dictionary_reclaim();
+    }
+    return NULL;
+}
+
+int dictionary_maintainer_start(void) {
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, dictionary_maintainer, NULL) != 0) {
+        fprintf(stderr, "ERROR: Failed to start the dictionary maintenance thread.\n");
+        return -1;
+    }
+    pthread_detach(thread);
+    return 0;
+}
+
+void handle_sighup(int signal_number) {
+    (void)signal_number;
+    dictionary_reload_requested = 1;
+}
+
+// Finds the next whitespace-separated word of a sentence, resuming where the
+// previous call stopped; the whole input is walked once.
+bool tokenizer_next(Tokenizer *tokenizer, size_t *start, size_t *length) {
+    const char *input = tokenizer->input;
+    size_t position = tokenizer->position;
+    while (input[position] != '\0' && isspace((unsigned char)input[position])) {
+        position++;
+    }
+    if (input[position] == '\0') {
+        tokenizer->position = position;
+        return false;
+    }
+
+    *start = position;
+    while (input[position] != '\0' && !isspace((unsigned char)input[position])) {
+        position++;
+    }
+    *length = position - *start;
+    tokenizer->position = position;
+    return true;
+}
+
+// Lower-cases the sentence in place and returns the spans of its words; the
+// only allocation is the span array.
+WordSpan *process_input(int *word_count, char *input) {
+    WordSpan *spans = NULL;
+    int capacity = 0;
+    Tokenizer tokenizer = {input, 0};
+    size_t start, length;
+
+    while (tokenizer_next(&tokenizer, &start, &length)) {
+        if (*word_count == capacity) {
+            capacity = capacity > 0 ? capacity * 2 : 16;
+            WordSpan *grown = (WordSpan *)realloc(spans, capacity * sizeof(WordSpan));
+            if (grown == NULL) {
+                fprintf(stderr, "ERROR: Memory reallocation failed.\n");
+                free(spans);
+                *word_count = 0;
+                return NULL;
+            }
+            spans = grown;
+        }
+
+        for (size_t i = start; i < start + length; i++) {
+            input[i] = tolower((unsigned char)input[i]);
+        }
+        spans[*word_count].offset = start;
+        spans[*word_count].length = length;
+        (*word_count)++;
+    }
+
+    return spans;
+}
+
+// Empties closest[]
+void closest_clear(WordDistance *closest) {
+    for (int i = 0; i < LEVENSHTEIN_LIST_LIMIT; i++) {
+        closest[i].word = NULL;
+        closest[i].distance = SIZE_MAX;
+        closest[i].frequency = 0;
+        closest[i].index = INT_MAX;
+    }
+}
+
+// Inserts a candidate into closest[], kept sorted by distance, then by
+// falling frequency, then by dictionary position, so every engine yields the
+// order of a full scan. The frequency is only read for a candidate that is
+// close enough to compete.
+void closest_insert(WordDistance *closest, const Dictionary *dictionary, int index, size_t distance) {
+    if (distance > closest[LEVENSHTEIN_LIST_LIMIT - 1].distance) {
+        return;
+    }
+    uint32_t frequency = dictionary_word_frequency(dictionary, index);
+    for (int j = 0; j < LEVENSHTEIN_LIST_LIMIT; j++) {
+        if (distance < closest[j].distance
+            || (distance == closest[j].distance
+                && (frequency > closest[j].frequency || (frequency == closest[j].frequency && index < closest[j].index)))) {
+            for (int k = LEVENSHTEIN_LIST_LIMIT - 1; k > j; k--) {
+                closest[k] = closest[k - 1];
+            }
+            closest[j].word = dictionary_word(dictionary, index);
+            closest[j].distance = distance;
+            closest[j].frequency = frequency;
+            closest[j].index = index;
+            break;
+        }
+    }
+}
+
+// Largest distance that can still enter closest[]. Equal distances are let
+// through because a more frequent or earlier word wins the tie.
+static inline size_t closest_bound(const WordDistance *closest) {
+    return closest[LEVENSHTEIN_LIST_LIMIT - 1].distance;
+}
+
+// Pruning bound of a scan slice: its own LEVENSHTEIN_LIST_LIMIT-th best, or
+// the best such bound any slice has reached if that is lower. Each slice with
+// a full list has that many words within its bound, so a word beyond the
+// smallest one cannot make the merged list either.
+static inline size_t scan_bound(const WordDistance *closest, atomic_size_t *shared_bound) {
+    size_t bound = closest_bound(closest);
+    if (shared_bound != NULL) {
+        size_t shared = atomic_load_explicit(shared_bound, memory_order_relaxed);
+        if (shared < bound) {
+            return shared;
+        }
+        while (bound < shared && !atomic_compare_exchange_weak_explicit(shared_bound, &shared, bound, memory_order_relaxed, memory_order_relaxed)) {
+        }
+    }
+    return bound;
+}
+
+// Scans the part of length bucket length within positions [first, last) of
+// length_order. With the SIMD kernel the words are compared in batches
+// straight from the bucket's transposed columns; a slice starting inside a
+// bucket starts at a multiple of 8 so the batches stay within its padded columns.
+static void search_bucket(const LevenshteinQuery *query, const Dictionary *dictionary, WordDistance *closest,
+                          int length, uint32_t first, uint32_t last, atomic_size_t *shared_bound) {
+    uint32_t distances[256];
+    uint32_t start = dictionary->length_starts[length] > first ? dictionary->length_starts[length] : first;
+    uint32_t end = dictionary->length_starts[length + 1] < last ? dictionary->length_starts[length + 1] : last;
+    if (start >= end) {
+        return;
+    }
+    const uint32_t *bucket = dictionary->length_order + dictionary->length_starts[length];
+    size_t offset = start - dictionary->length_starts[length];
+    size_t bucket_end = end - dictionary->length_starts[length];
+
+    if (!query->batched) {
+        for (size_t i = offset; i < bucket_end; i++) {
+            int index = (int)bucket[i];
+            size_t distance = levenshtein_query_bounded(query, dictionary_word(dictionary, index), length, scan_bound(closest, shared_bound));
+            closest_insert(closest, dictionary, index, distance);
+        }
+        return;
+    }
+
+    size_t stride = bucket_stride(dictionary, length);
+    const char *columns = dictionary->columns + dictionary->column_offsets[length];
+    for (size_t batch = offset; batch < bucket_end; batch += 256) {
+        size_t count = bucket_end - batch < 256 ? bucket_end - batch : 256;
+        levenshtein_batch(query, columns + batch, stride, length, (count + 7) & ~(size_t)7, distances);
+        for (size_t i = 0; i < count; i++) {
+            closest_insert(closest, dictionary, (int)bucket[batch + i], distances[i]);
+        }
+        scan_bound(closest, shared_bound); // Publish the improved bound to the other slices
+    }
+}
+
+// Scans positions [first, last) of length_order. Buckets are visited by
+// growing length gap to the query, nearest first, since the gap is a lower
+// bound on the distance: once it exceeds the current bound no later bucket
+// can contribute and the scan stops. The visiting order does not change the
+// result, closest_insert ranks by (distance, index) whatever comes first.
+void search_scan_range(const LevenshteinQuery *query, const Dictionary *dictionary, WordDistance *closest,
+                       uint32_t first, uint32_t last, atomic_size_t *shared_bound) {
+    for (size_t gap = 0; gap <= scan_bound(closest, shared_bound); gap++) {
+        if (query->length <= gap && query->length + gap >= WORD_LENGTH) {
+            break; // No bucket left on either side
+        }
+        bool below = query->length > gap && query->length - gap < WORD_LENGTH;
+        bool above = gap > 0 && query->length + gap < WORD_LENGTH;
+        if (below) {
+            search_bucket(query, dictionary, closest, (int)(query->length - gap), first, last, shared_bound);
+        }
+        if (above && gap <= scan_bound(closest, shared_bound)) {
+            search_bucket(query, dictionary, closest, (int)(query->length + gap), first, last, shared_bound);
+        }
+    }
+}
+
+// One slice of a split scan with its own best-matches list
+typedef struct {
+    const LevenshteinQuery *query;
+    const Dictionary *dictionary;
+    WordDistance *closest;
+    uint32_t first;
+    uint32_t last;
+    atomic_size_t *shared_bound;
+    TaskGroup *group;
+} ScanSlice;
+
+void scan_slice_task(void *arg) {
+    ScanSlice *slice = (ScanSlice *)arg;
+    search_scan_range(slice->query, slice->dictionary, slice->closest, slice->first, slice->last, slice->shared_bound);
+    task_group_done(slice->group);
+}
+
+// Scans the whole dictionary. Large dictionaries are split into one slice per
+// scan thread; the slices' lists are merged by (distance, index), so the
+// result is the same as a single scan whatever order the slices finish in.
+void search_scan(const LevenshteinQuery *query, const Dictionary *dictionary, WordDistance *closest) {
+    uint32_t total = dictionary->length_starts[WORD_LENGTH];
+    int slice_count = SCAN_CHUNK_WORDS > 0 ? (int)(total / (uint32_t)SCAN_CHUNK_WORDS) : 0;
+    if (slice_count > scan_thread_count) {
+        slice_count = scan_thread_count;
+    }
+    ScanSlice *slices = slice_count > 1 ? (ScanSlice *)malloc(slice_count * sizeof(ScanSlice)) : NULL;
+    WordDistance *lists = slices != NULL ? (WordDistance *)malloc((size_t)slice_count * LEVENSHTEIN_LIST_LIMIT * sizeof(WordDistance)) : NULL;
+    if (lists == NULL) {
+        free(slices);
+        search_scan_range(query, dictionary, closest, 0, total, NULL);
+        return;
+    }
+
+    atomic_size_t shared_bound = SIZE_MAX;
+    TaskGroup group;
+    task_group_init(&group, slice_count - 1);
+    uint32_t first = 0;
+    for (int i = 0; i < slice_count; i++) {
+        uint32_t last = total;
+        if (i < slice_count - 1) {
+            // Move the boundary back to a multiple of 8 within its bucket
+            last = (uint32_t)((uint64_t)total * (i + 1) / slice_count);
+            int length = 1;
+            while (dictionary->length_starts[length + 1] <= last) {
+                length++;
+            }
+            last -= (last - dictionary->length_starts[length]) & 7;
+            if (last < first) {
+                last = first;
+            }
+        }
+        ScanSlice *slice = &slices[i];
+        slice->query = query;
+        slice->dictionary = dictionary;
+        slice->closest = lists + (size_t)i * LEVENSHTEIN_LIST_LIMIT;
+        slice->first = first;
+        slice->last = last;
+        slice->shared_bound = &shared_bound;
+        slice->group = &group;
+        closest_clear(slice->closest);
+        first = last;
+    }
+
+    // The first slice runs here while the scan pool takes the others
+    for (int i = 1; i < slice_count; i++) {
+        if (thread_pool_submit(&scan_pool, scan_slice_task, &slices[i]) != 0) {
+            scan_slice_task(&slices[i]);
+        }
+    }
+    search_scan_range(query, dictionary, slices[0].closest, slices[0].first, slices[0].last, &shared_bound);
+    task_group_wait(&group);
+
+    for (int i = 0; i < slice_count; i++) {
+        for (int j = 0; j < LEVENSHTEIN_LIST_LIMIT && slices[i].closest[j].word != NULL; j++) {
+            closest_insert(closest, dictionary, slices[i].closest[j].index, slices[i].closest[j].distance);
+        }
+    }
+    free(lists);
+    free(slices);
+}
+
+// Depth-first BK-tree walk. A child at edge distance e below a node at distance d
+// can only hold words at distance >= |e - d|, so subtrees beyond the current
+// LEVENSHTEIN_LIST_LIMIT-th best distance are skipped. The tree is built on
+// Levenshtein distance; for optimal string alignment the walk still steers by
+// it and bounds with half of it, as a transposition is at most two Levenshtein edits.
+void search_bktree(const LevenshteinQuery *query, const Dictionary *dictionary, WordDistance *closest) {
+    if (dictionary->word_count == 0) {
+        return;
+    }
+
+    typedef struct {
+        uint32_t node;
+        size_t lower_bound;
+    } BKTreeVisit;
+
+    BKTreeVisit local_stack[256];
+    BKTreeVisit *stack = local_stack;
+    size_t stack_capacity = sizeof(local_stack) / sizeof(local_stack[0]);
+    size_t stack_size = 0;
+    const BKTreeNode *nodes = dictionary->bktree;
+
+    stack[stack_size++] = (BKTreeVisit){0, 0};
+    while (stack_size > 0) {
+        BKTreeVisit visit = stack[--stack_size];
+        if (visit.lower_bound > closest[LEVENSHTEIN_LIST_LIMIT - 1].distance) {
+            continue;
+        }
+
+        const char *word = dictionary_word(dictionary, visit.node);
+        size_t distance = levenshtein_query_edits(query, word, dictionary->lengths[visit.node], SIZE_MAX);
+        if (!query->transpositions) {
+            closest_insert(closest, dictionary, visit.node, distance);
+        } else if ((distance + 1) / 2 <= closest_bound(closest)) {
+            // Bounded like the scan: a word beyond the list comes back above the bound and is not inserted
+            closest_insert(closest, dictionary, visit.node,
+                           levenshtein_query_bounded(query, word, dictionary->lengths[visit.node], closest_bound(closest)));
+        }
+
+        size_t threshold = closest[LEVENSHTEIN_LIST_LIMIT - 1].distance;
+        for (uint32_t child = nodes[visit.node].first_child; child != 0; child = nodes[child].next_sibling) {
+            size_t edge = nodes[child].distance;
+            size_t lower_bound = edge > distance ? edge - distance : distance - edge;
+            if (query->transpositions) {
+                lower_bound = (lower_bound + 1) / 2;
+            }
+            if (lower_bound > threshold) {
+                continue;
+            }
+
+            if (stack_size == stack_capacity) {
+                size_t capacity = stack_capacity * 2;
+                BKTreeVisit *grown = (BKTreeVisit *)malloc(capacity * sizeof(BKTreeVisit));
+                if (grown == NULL) {
+                    fprintf(stderr, "ERROR: Memory allocation failed.\n");
+                    break;
+                }
+                memcpy(grown, stack, stack_size * sizeof(BKTreeVisit));
+                if (stack != local_stack) {
+                    free(stack);
+                }
+                stack = grown;
+                stack_capacity = capacity;
+            }
+            stack[stack_size++] = (BKTreeVisit){child, lower_bound};
+        }
+    }
+
+    if (stack != local_stack) {
+        free(stack);
+    }
+}
+
+// Children of a trie node still to be visited
+typedef struct {
+    uint32_t first_child;
+    uint16_t child_count;
+    uint16_t start; // Child visited first
+    uint16_t visited;
+} TrieVisit;
+
+// Starts visiting the children of node at depth with the one that continues
+// the query, if there is one
+static TrieVisit trie_visit(const TrieNode *nodes, uint32_t node, const LevenshteinQuery *query, uint32_t depth) {
+    TrieVisit visit = {nodes[node].first_child, nodes[node].child_count, 0, 0};
+    if (depth < query->length) {
+        for (uint16_t i = 0; i < visit.child_count; i++) {
+            if (nodes[visit.first_child + i].character == query->word[depth]) {
+                visit.start = i;
+                break;
+            }
+        }
+    }
+    return visit;
+}
+
+// Depth-first trie walk carrying one Levenshtein DP row per depth: a node's
+// row extends its parent's by one character, so a prefix shared by many
+// words is computed once. For optimal string alignment the row two levels
+// up supplies the transposition step. Row values only grow with depth, so a subtree whose
+// row minimum exceeds the LEVENSHTEIN_LIST_LIMIT-th best distance is skipped.
+// The child spelling on along the query is visited first, so close words fill
+// the list early and tighten that bound for the rest of the walk.
+void search_trie(const LevenshteinQuery *query, const Dictionary *dictionary, WordDistance *closest) {
+
+    const TrieNode *nodes = dictionary->trie;
+    if (dictionary->trie_node_count == 0 || nodes[0].child_count == 0) {
+        return;
+    }
+    size_t width = query->length + 1;
+    uint32_t local_rows[WORD_LENGTH * WORD_LENGTH];
+    uint32_t *rows = local_rows;
+    if (width > WORD_LENGTH) {
+        rows = (uint32_t *)malloc(WORD_LENGTH * width * sizeof(uint32_t));
+        if (rows == NULL) {
+            fprintf(stderr, "ERROR: Memory allocation failed.\n");
+            return;
+        }
+    }
+    TrieVisit stack[WORD_LENGTH];
+    char path[WORD_LENGTH]; // Characters of the current node's prefix, path[depth - 1] is the node's
+
+    for (size_t j = 0; j < width; j++) {
+        rows[j] = (uint32_t)j;
+    }
+    int top = 0;
+    stack[0] = trie_visit(nodes, 0, query, 0);
+    while (top >= 0) {
+        TrieVisit *visit = &stack[top];
+        if (visit->visited == visit->child_count) {
+            top--;
+            continue;
+        }
+        uint32_t child = (visit->start + visit->visited++) % visit->child_count;
+        const TrieNode *node = &nodes[visit->first_child + child];
+        uint32_t depth = (uint32_t)top + 1;
+        const uint32_t *previous = rows + (depth - 1) * width;
+        uint32_t *row = rows + depth * width;
+
+        path[depth - 1] = node->character;
+        row[0] = depth;
+        uint32_t minimum = depth;
+        for (size_t j = 1; j < width; j++) {
+            uint32_t value = previous[j - 1] + (query->word[j - 1] != node->character);
+            if (previous[j] + 1 < value) {
+                value = previous[j] + 1;
+            }
+            if (row[j - 1] + 1 < value) {
+                value = row[j - 1] + 1;
+            }
+            if (query->transpositions && depth > 1 && j > 1 && query->word[j - 2] == node->character
+                && query->word[j - 1] == path[depth - 2] && rows[(depth - 2) * width + j - 2] + 1 < value) {
+                value = rows[(depth - 2) * width + j - 2] + 1;
+            }
+            row[j] = value;
+            if (value < minimum) {
+                minimum = value;
+            }
+        }
+
+        for (uint32_t i = 0; i < node->word_count; i++) {
+            closest_insert(closest, dictionary, (int)dictionary->trie_words[node->first_word + i], row[width - 1]);
+        }
+        if (node->child_count > 0 && minimum <= closest_bound(closest) && depth < WORD_LENGTH - 1) {
+            top++;
+            stack[top] = trie_visit(nodes, (uint32_t)(node - nodes), query, depth);
+        }
+    }
+
+    if (rows != local_rows) {
+        free(rows);
+    }
+}
+
+// Scans the words added since the index was built, from overlay word first on.
+// Under the deletion index they are held to its max_distance like indexed words.
+void search_overlay(const LevenshteinQuery *query, const Dictionary *dictionary, WordDistance *closest, int first) {
+    size_t limit = dictionary->deletion_index != NULL ? (size_t)dictionary->deletion_index->max_distance : SIZE_MAX;
+    for (int i = first; i < dictionary->overlay_count; i++) {
+        size_t bound = closest_bound(closest) < limit ? closest_bound(closest) : limit;
+        size_t distance = levenshtein_query_bounded(query, dictionary->overlay_words + (size_t)i * WORD_LENGTH,
+                                                    dictionary->overlay_lengths[i], bound);
+        if (distance <= limit) {
+            closest_insert(closest, dictionary, dictionary->word_count + i, distance);
+        }
+    }
+}
+
+int compare_word_indices(const void *a, const void *b) {
+    uint32_t left = *(const uint32_t *)a;
+    uint32_t right = *(const uint32_t *)b;
+    return (left > right) - (left < right);
+}
+
+// Lookups answered by the deletion index, and how many of them found fewer
+// than LEVENSHTEIN_LIST_LIMIT words within max_distance
+atomic_ullong deletes_lookups = 0;
+atomic_ullong deletes_short = 0;
+
+// Looks up the deletes of the input word, verifies every candidate with
+// levenshtein_n and keeps those within max_distance. Words further away are
+// never suggested: filling the list from a full scan would make the common
+// lookup slower than the scan engine itself, so the list may come back short
+// or empty.
+void search_deletes(const LevenshteinQuery *query, const Dictionary *dictionary, WordDistance *closest) {
+    const DeletionIndex *index = dictionary->deletion_index;
+    DeleteList deletes = {NULL, 0, 0};
+    uint32_t *candidates = NULL;
+    size_t candidate_count = 0;
+
+    // Dictionary words are shorter than WORD_LENGTH, longer input cannot be within reach
+    if (query->length < WORD_LENGTH + (size_t)index->max_distance
+        && generate_deletes(query->word, query->length, index->max_distance, 0, &deletes) == 0) {
+        size_t candidate_capacity = 0;
+        for (size_t i = 0; i < deletes.size; i++) {
+            size_t slot = deletion_index_slot(index, deletes.entries[i].hash);
+            if (index->hashes[slot] == 0) {
+                continue;
+            }
+            if (candidate_count + index->counts[slot] > candidate_capacity) {
+                candidate_capacity = (candidate_count + index->counts[slot]) * 2;
+                uint32_t *grown = (uint32_t *)realloc(candidates, candidate_capacity * sizeof(uint32_t));
+                if (grown == NULL) {
+                    candidate_count = 0;
+                    break;
+                }
+                candidates = grown;
+            }
+            memcpy(candidates + candidate_count, index->postings + index->starts[slot], index->counts[slot] * sizeof(uint32_t));
+            candidate_count += index->counts[slot];
+        }
+    }
+    free(deletes.entries);
+
+    if (candidate_count > 0) {
+        qsort(candidates, candidate_count, sizeof(uint32_t), compare_word_indices);
+        for (size_t i = 0; i < candidate_count; i++) {
+            if (i > 0 && candidates[i] == candidates[i - 1]) {
+                continue;
+            }
+            int word = (int)candidates[i];
+            size_t distance = levenshtein_query_bounded(query, dictionary_word(dictionary, word), dictionary->lengths[word], index->max_distance);
+            if (distance <= (size_t)index->max_distance) {
+                closest_insert(closest, dictionary, word, distance);
+            }
+        }
+    }
+    free(candidates);
+
+    atomic_fetch_add(&deletes_lookups, 1);
+    if (closest[LEVENSHTEIN_LIST_LIMIT - 1].word == NULL) {
+        atomic_fetch_add(&deletes_short, 1);
+    }
+}
+
+// Cache of lookup results, split into shards with their own lock and LRU
+// list. An entry is keyed by the input word, the metric and the version of the base
+// arrays, and remembers how many overlay words it has seen: a snapshot with
+// more added words only has to check those, so additions never invalidate it.
+#define RESULT_CACHE_SHARDS 16
+
+typedef struct {
+    char word[WORD_LENGTH];
+    uint8_t length;
+    uint64_t version;
+    uint8_t metric;
+    int overlay_count;
+    int hash_next; // Next entry in the same bucket, -1 ends the chain
+    int newer; // LRU neighbours, -1 at the ends
+    int older;
+} ResultCacheEntry;
+
+typedef struct {
+    pthread_mutex_t mutex;
+    ResultCacheEntry *entries;
+    int *indices; // LEVENSHTEIN_LIST_LIMIT word indices per entry, -1 for none
+    size_t *distances; // and their distances
+    int *buckets;
+    size_t bucket_mask;
+    int capacity;
+    int count;
+    int newest;
+    int oldest;
+} ResultCacheShard;
+
+ResultCacheShard result_cache[RESULT_CACHE_SHARDS];
+atomic_ullong result_cache_hits = 0;
+atomic_ullong result_cache_misses = 0;
+
+int result_cache_init(void) {
+    int capacity = (RESULT_CACHE_SIZE + RESULT_CACHE_SHARDS - 1) / RESULT_CACHE_SHARDS;
+    for (int i = 0; i < RESULT_CACHE_SHARDS && capacity > 0; i++) {
+        ResultCacheShard *shard = &result_cache[i];
+        size_t bucket_count = 16;
+        while (bucket_count < (size_t)capacity) {
+            bucket_count *= 2;
+        }
+        pthread_mutex_init(&shard->mutex, NULL);
+        shard->entries = (ResultCacheEntry *)malloc(capacity * sizeof(ResultCacheEntry));
+        shard->indices = (int *)malloc((size_t)capacity * LEVENSHTEIN_LIST_LIMIT * sizeof(int));
+        shard->distances = (size_t *)malloc((size_t)capacity * LEVENSHTEIN_LIST_LIMIT * sizeof(size_t));
+        shard->buckets = (int *)malloc(bucket_count * sizeof(int));
+        if (shard->entries == NULL || shard->indices == NULL || shard->distances == NULL || shard->buckets == NULL) {
+            fprintf(stderr, "ERROR: Memory allocation failed.\n");
+            return -1;
+        }
+        memset(shard->buckets, 0xff, bucket_count * sizeof(int));
+        shard->bucket_mask = bucket_count - 1;
+        shard->capacity = capacity;
+        shard->newest = shard->oldest = -1;
+    }
+    return 0;
+}
+
+static uint64_t result_cache_hash(const char *word, size_t length, uint64_t version, DistanceMetric metric) {
+    return delete_hash(word, length) ^ ((version * 2 + metric) * 0x9e3779b97f4a7c15ULL);
+}
+
+// Finds the entry for word in a locked shard, or returns -1
+static int result_cache_find(const ResultCacheShard *shard, uint64_t hash, const char *word, size_t length, uint64_t version,
+                             DistanceMetric metric) {
+    for (int entry = shard->buckets[hash & shard->bucket_mask]; entry != -1; entry = shard->entries[entry].hash_next) {
+        const ResultCacheEntry *candidate = &shard->entries[entry];
+        if (candidate->version == version && candidate->metric == metric && candidate->length == length
+            && memcmp(candidate->word, word, length) == 0) {
+            return entry;
+        }
+    }
+    return -1;
+}
+
+static void result_cache_unlink(ResultCacheShard *shard, int entry) {
+    ResultCacheEntry *item = &shard->entries[entry];
+    if (item->newer != -1) {
+        shard->entries[item->newer].older = item->older;
+    } else {
+        shard->newest = item->older;
+    }
+    if (item->older != -1) {
+        shard->entries[item->older].newer = item->newer;
+    } else {
+        shard->oldest = item->newer;
+    }
+}
+
+static void result_cache_push_newest(ResultCacheShard *shard, int entry) {
+    ResultCacheEntry *item = &shard->entries[entry];
+    item->newer = -1;
+    item->older = shard->newest;
+    if (shard->newest != -1) {
+        shard->entries[shard->newest].newer = entry;
+    } else {
+        shard->oldest = entry;
+    }
+    shard->newest = entry;
+}
+
+// Fills closest from the cache. Returns the number of overlay words the
+// cached result has seen, or -1 on a miss.
+int result_cache_lookup(const char *word, size_t length, const Dictionary *dictionary, DistanceMetric metric, WordDistance *closest) {
+    if (RESULT_CACHE_SIZE <= 0 || length >= WORD_LENGTH) {
+        return -1;
+    }
+    uint64_t hash = result_cache_hash(word, length, dictionary->version, metric);
+    ResultCacheShard *shard = &result_cache[hash >> 60];
+
+    pthread_mutex_lock(&shard->mutex);
+    int entry = result_cache_find(shard, hash, word, length, dictionary->version, metric);
+    int overlay_count = entry != -1 ? shard->entries[entry].overlay_count : -1;
+    if (overlay_count > dictionary->overlay_count) {
+        overlay_count = -1; // Stored by a newer snapshot, holds words this one lacks
+    }
+    if (overlay_count != -1) {
+        const int *indices = shard->indices + (size_t)entry * LEVENSHTEIN_LIST_LIMIT;
+        const size_t *distances = shard->distances + (size_t)entry * LEVENSHTEIN_LIST_LIMIT;
+        for (int i = 0; i < LEVENSHTEIN_LIST_LIMIT && indices[i] != -1; i++) {
+            closest[i].word = dictionary_word(dictionary, indices[i]);
+            closest[i].distance = distances[i];
+            closest[i].frequency = dictionary_word_frequency(dictionary, indices[i]);
+            closest[i].index = indices[i];
+        }
+        result_cache_unlink(shard, entry);
+        result_cache_push_newest(shard, entry);
+    }
+    pthread_mutex_unlock(&shard->mutex);
+
+    atomic_fetch_add(overlay_count != -1 ? &result_cache_hits : &result_cache_misses, 1);
+    return overlay_count;
+}
+
+// Stores the result for word, replacing the least recently used entry of its
+// shard when the shard is full
+void result_cache_store(const char *word, size_t length, const Dictionary *dictionary, DistanceMetric metric,
+                        const WordDistance *closest) {
+    if (RESULT_CACHE_SIZE <= 0 || length >= WORD_LENGTH) {
+        return;
+    }
+    uint64_t hash = result_cache_hash(word, length, dictionary->version, metric);
+    ResultCacheShard *shard = &result_cache[hash >> 60];
+
+    pthread_mutex_lock(&shard->mutex);
+    int entry = result_cache_find(shard, hash, word, length, dictionary->version, metric);
+    if (entry != -1) {
+        result_cache_unlink(shard, entry);
+    } else {
+        if (shard->count < shard->capacity) {
+            entry = shard->count++;
+        } else {
+            // Evict the oldest entry and take it out of its bucket chain
+            entry = shard->oldest;
+            result_cache_unlink(shard, entry);
+            const ResultCacheEntry *evicted = &shard->entries[entry];
+            int *link = &shard->buckets[result_cache_hash(evicted->word, evicted->length, evicted->version, (DistanceMetric)evicted->metric) & shard->bucket_mask];
+            while (*link != entry) {
+                link = &shard->entries[*link].hash_next;
+            }
+            *link = evicted->hash_next;
+        }
+        ResultCacheEntry *item = &shard->entries[entry];
+        memcpy(item->word, word, length);
+        item->length = (uint8_t)length;
+        item->version = dictionary->version;
+        item->metric = (uint8_t)metric;
+        item->hash_next = shard->buckets[hash & shard->bucket_mask];
+        shard->buckets[hash & shard->bucket_mask] = entry;
+    }
+
+    shard->entries[entry].overlay_count = dictionary->overlay_count;
+    int *indices = shard->indices + (size_t)entry * LEVENSHTEIN_LIST_LIMIT;
+    size_t *distances = shard->distances + (size_t)entry * LEVENSHTEIN_LIST_LIMIT;
+    for (int i = 0; i < LEVENSHTEIN_LIST_LIMIT; i++) {
+        indices[i] = closest[i].word != NULL ? closest[i].index : -1;
+        distances[i] = closest[i].distance;
+    }
+    result_cache_push_newest(shard, entry);
+    pthread_mutex_unlock(&shard->mutex);
+}
+
+int result_cache_count(void) {
+    int count = 0;
+    for (int i = 0; i < RESULT_CACHE_SHARDS && RESULT_CACHE_SIZE > 0; i++) {
+        pthread_mutex_lock(&result_cache[i].mutex);
+        count += result_cache[i].count;
+        pthread_mutex_unlock(&result_cache[i].mutex);
+    }
+    return count;
+}
+
+// Answers a word that is in the dictionary without a search: closest gets
+// the word itself at distance 0 and nothing else. Returns false for unknown words.
+bool find_exact_word(const char *input_word, size_t input_length, const Dictionary *dictionary, WordDistance *closest) {
+    int index = -1;
+    if (dictionary->words.slots != NULL) {
+        index = word_set_find(&dictionary->words, dictionary, input_word, input_length);
+    }
+    for (int i = 0; index == -1 && i < dictionary->overlay_count; i++) {
+        if (dictionary->overlay_lengths[i] == input_length
+            && memcmp(dictionary->overlay_words + (size_t)i * WORD_LENGTH, input_word, input_length) == 0) {
+            index = dictionary->word_count + i;
+        }
+    }
+    if (index == -1) {
+        return false;
+    }
+
+    closest_clear(closest);
+    closest[0].word = dictionary_word(dictionary, index);
+    closest[0].distance = 0;
+    closest[0].frequency = dictionary_word_frequency(dictionary, index);
+    closest[0].index = index;
+    return true;
+}
+
+void find_closest_words(const char *input_word, size_t input_length, const Dictionary *dictionary, DistanceMetric metric,
+                        WordDistance *closest) {
+    closest_clear(closest);
+
+    LevenshteinQuery query;
+    int cached_overlay = result_cache_lookup(input_word, input_length, dictionary, metric, closest);
+    if (cached_overlay == dictionary->overlay_count) {
+        return;
+    }
+    levenshtein_query_init(&query, input_word, input_length, metric);
+    if (cached_overlay != -1) {
+        // Cached before the last additions: only the words added since are new
+        search_overlay(&query, dictionary, closest, cached_overlay);
+    } else {
+        if (dictionary->bktree != NULL) {
+            search_bktree(&query, dictionary, closest);
+        } else if (dictionary->deletion_index != NULL) {
+            search_deletes(&query, dictionary, closest);
+        } else if (dictionary->trie != NULL) {
+            search_trie(&query, dictionary, closest);
+        } else {
+            search_scan(&query, dictionary, closest);
+        }
+        search_overlay(&query, dictionary, closest, 0);
+    }
+    result_cache_store(input_word, input_length, dictionary, metric, closest);
+}
+
+
+typedef struct {
+    const char *input_word; // Points into the sentence, not NUL-terminated
+    size_t input_length;
+    Dictionary *dictionary;
+    TaskGroup *group;
+    WordDistance *closest; // LEVENSHTEIN_LIST_LIMIT best matches
+    LookupOptions options;
+    int is_word_found;
+    const char *closest_word;
+    int word_position;
+} ThreadData;
+
+// A looked-up sentence whose results are sent word by word. It stays on the
+// connection while the client answers an add-word prompt.
+typedef struct SentenceRequest {
+    char *sentence; // Text the spans point into; the receive buffer until detached
+    bool owns_sentence;
+    WordSpan *spans;
+    int word_count;
+    ThreadData *words;
+    WordDistance *matches; // Storage behind words[i].closest
+    Dictionary *dictionary; // Snapshot the words were looked up in
+    int next_word; // Word whose results are sent next, or whose answer is awaited
+} SentenceRequest;
+
+
+
+void print_usage(const char *program_name) {
+    fprintf(stderr, "Usage: %s [--engine scan|bktree|deletes|trie] [--max-distance N] [--kernel simd|myers|dp] [--backlog N] [--workers N] [--lookup-threads N] [--scan-threads N] [--scan-chunk N] [--cache-size N] [--max-line N] [--binary FILE] [--compile FILE]\n", program_name);
+    fprintf(stderr, "  --compile FILE  write the word list and the index of the selected engine to FILE and exit\n");
+    fprintf(stderr, "  --binary FILE   map a dictionary written by --compile with the same engine at startup\n");
+    fprintf(stderr, "  --max-line N    longest input line in bytes (default 8192), longer lines are answered with an error\n");
+}
+
+void parse_arguments(int argc, char *argv[]) {
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--engine") == 0 && i + 1 < argc) {
+            const char *engine = argv[++i];
+            if (strcmp(engine, "scan") == 0) {
+                SEARCH_ENGINE = ENGINE_SCAN;
+            } else if (strcmp(engine, "bktree") == 0) {
+                SEARCH_ENGINE = ENGINE_BKTREE;
+            } else if (strcmp(engine, "deletes") == 0) {
+                SEARCH_ENGINE = ENGINE_DELETES;
+            } else if (strcmp(engine, "trie") == 0) {
+                SEARCH_ENGINE = ENGINE_TRIE;
+            } else {
+                fprintf(stderr, "ERROR: Unknown search engine \"%s\"!\n", engine);
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+        } else if (strcmp(argv[i], "--kernel") == 0 && i + 1 < argc) {
+            const char *kernel = argv[++i];
+            if (strcmp(kernel, "simd") == 0) {
+                LEVENSHTEIN_KERNEL = KERNEL_SIMD;
+            } else if (strcmp(kernel, "myers") == 0) {
+                LEVENSHTEIN_KERNEL = KERNEL_MYERS;
+            } else if (strcmp(kernel, "dp") == 0) {
+                LEVENSHTEIN_KERNEL = KERNEL_DP;
+            } else {
+                fprintf(stderr, "ERROR: Unknown distance kernel \"%s\"!\n", kernel);
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+        } else if (strcmp(argv[i], "--backlog") == 0 && i + 1 < argc) {
+            LISTEN_BACKLOG = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc) {
+            WORKER_THREADS = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--lookup-threads") == 0 && i + 1 < argc) {
+            LOOKUP_THREADS = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--scan-threads") == 0 && i + 1 < argc) {
+            SCAN_THREADS = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--scan-chunk") == 0 && i + 1 < argc) {
+            SCAN_CHUNK_WORDS = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--cache-size") == 0 && i + 1 < argc) {
+            RESULT_CACHE_SIZE = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--max-line") == 0 && i + 1 < argc) {
+            INPUT_LINE_LIMIT = atoi(argv[++i]);
+            if (INPUT_LINE_LIMIT <= 0) {
+                fprintf(stderr, "ERROR: --max-line must be positive!\n");
+                exit(EXIT_FAILURE);
+            }
+        } else if (strcmp(argv[i], "--binary") == 0 && i + 1 < argc) {
+            DICTIONARY_BINARY = argv[++i];
+        } else if (strcmp(argv[i], "--compile") == 0 && i + 1 < argc) {
+            COMPILE_OUTPUT = argv[++i];
+        } else if (strcmp(argv[i], "--max-distance") == 0 && i + 1 < argc) {
+            SYMSPELL_MAX_DISTANCE = atoi(argv[++i]);
+            if (SYMSPELL_MAX_DISTANCE < 0 || SYMSPELL_MAX_DISTANCE > 4) {
+                fprintf(stderr, "ERROR: --max-distance must be between 0 and 4!\n");
+                exit(EXIT_FAILURE);
+            }
+        } else {
+            print_usage(argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+int main(int argc, char *argv[]) {
+    parse_arguments(argc, argv);
+    snprintf(dictionary_log_path, sizeof(dictionary_log_path), "%s.wal", DICTIONARY_FILE);
+    if (LEVENSHTEIN_KERNEL == KERNEL_SIMD) {
+        printf("Batched distance kernel: %s\n", levenshtein_batch_init());
+    }
+
+    if (COMPILE_OUTPUT != NULL) {
+        DICTIONARY_BINARY = NULL; // Always compile from the word list
+        Dictionary *dictionary = dictionary_load(DICTIONARY_FILE);
+        if (dictionary == NULL || dictionary_compile(dictionary, DICTIONARY_FILE, COMPILE_OUTPUT) != 0) {
+            exit(EXIT_FAILURE);
+        }
+        printf("Compiled %d words into %s.\n", dictionary->word_count, COMPILE_OUTPUT);
+        dictionary_free(dictionary);
+        return 0;
+    }
+
+    // Load the dictionary once; connections share this snapshot
+    Dictionary *dictionary = dictionary_load(DICTIONARY_FILE);
+    if (dictionary == NULL) {
+        exit(EXIT_FAILURE);
+    }
+    atomic_store(&current_dictionary, dictionary);
+    dictionary_mtime = dictionary_file_mtime(DICTIONARY_FILE);
+    if (wal_open() != 0 || result_cache_init() != 0 || dictionary_maintainer_start() != 0) {
+        exit(EXIT_FAILURE);
+    }
+    printf("Dictionary %s: %d words.\n", dictionary->mapping != NULL ? "mapped" : "loaded", dictionary->word_count);
+
+    // SIGHUP requests a dictionary reload; no SA_RESTART so the event wait wakes up
+    struct sigaction reload_action;
+    memset(&reload_action, 0, sizeof(reload_action));
+    reload_action.sa_handler = handle_sighup;
+    sigemptyset(&reload_action.sa_mask);
+    sigaction(SIGHUP, &reload_action, NULL);
+
+    signal(SIGPIPE, SIG_IGN); // A client vanishing mid-send must not kill the server
+
+    printf("Sunucu %d portunda başlatılıyor...\n", PORT_NUMBER);
+    start_server(PORT_NUMBER);
+}
+
+void *thread_pool_worker(void *arg) {
+    ThreadPool *pool = (ThreadPool *)arg;
+
+    while (1) {
+        pthread_mutex_lock(&pool->mutex);
+        while (pool->head == NULL) {
+            pthread_cond_wait(&pool->task_available, &pool->mutex);
+        }
+        Task *task = pool->head;
+        pool->head = task->next;
+        if (pool->head == NULL) {
+            pool->tail = NULL;
+        }
+        pthread_mutex_unlock(&pool->mutex);
+
+        task->function(task->argument);
+        free(task);
+    }
+    return NULL;
+}
+
+int thread_pool_init(ThreadPool *pool, int thread_count) {
+    pool->head = NULL;
+    pool->tail = NULL;
+    pool->thread_count = thread_count;
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->task_available, NULL);
+    pool->threads = (pthread_t *)malloc(thread_count * sizeof(pthread_t));
+    if (pool->threads == NULL) {
+        fprintf(stderr, "ERROR: Memory allocation failed.\n");
+        return -1;
+    }
+
+    for (int i = 0; i < thread_count; i++) {
+        if (pthread_create(&pool->threads[i], NULL, thread_pool_worker, pool) != 0) {
+            fprintf(stderr, "ERROR: Failed to create worker thread %d.\n", i + 1);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int thread_pool_submit(ThreadPool *pool, void (*function)(void *), void *argument) {
+    Task *task = (Task *)malloc(sizeof(Task));
+    if (task == NULL) {
+        fprintf(stderr, "ERROR: Memory allocation failed.\n");
+        return -1;
+    }
+    task->function = function;
+    task->argument = argument;
+    task->next = NULL;
+
+    pthread_mutex_lock(&pool->mutex);
+    if (pool->tail != NULL) {
+        pool->tail->next = task;
+    } else {
+        pool->head = task;
+    }
+    pool->tail = task;
+    pthread_cond_signal(&pool->task_available);
+    pthread_mutex_unlock(&pool->mutex);
+    return 0;
+}
+
+void task_group_init(TaskGroup *group, int pending) {
+    group->pending = pending;
+    pthread_mutex_init(&group->mutex, NULL);
+    pthread_cond_init(&group->finished, NULL);
+}
+
+void task_group_done(TaskGroup *group) {
+    pthread_mutex_lock(&group->mutex);
+    if (--group->pending == 0) {
+        pthread_cond_broadcast(&group->finished);
+    }
+    pthread_mutex_unlock(&group->mutex);
+}
+
+void task_group_wait(TaskGroup *group) {
+    pthread_mutex_lock(&group->mutex);
+    while (group->pending > 0) {
+        pthread_cond_wait(&group->finished, &group->mutex);
+    }
+    pthread_mutex_unlock(&group->mutex);
+    pthread_mutex_destroy(&group->mutex);
+    pthread_cond_destroy(&group->finished);
+}
+
+int online_cpu_count(void) {
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (int)count : 1;
+}
+
+int event_queue_create(void) {
+#ifdef __linux__
+    return epoll_create1(0);
+#else
+    return kqueue();
+#endif
+}
+
+// Watches fd for input. A one-shot watch fires once and stays disabled until
+// event_queue_rearm, which hands the connection to exactly one thread.
+int event_queue_add(int fd, void *data, bool one_shot) {
+#ifdef __linux__
+    struct epoll_event event;
+    event.events = EPOLLIN | (one_shot ? EPOLLONESHOT : 0);
+    event.data.ptr = data;
+    return epoll_ctl(event_queue, EPOLL_CTL_ADD, fd, &event);
+#else
+    struct kevent event;
+    EV_SET(&event, fd, EVFILT_READ, EV_ADD | (one_shot ? EV_DISPATCH : 0), 0, 0, data);
+    return kevent(event_queue, &event, 1, NULL, 0, NULL);
+#endif
+}
+
+// Re-enables a one-shot watch, for input or, while a reply is pending, for
+// room in the socket's send buffer.
+int event_queue_rearm(int fd, void *data, bool writable) {
+#ifdef __linux__
+    struct epoll_event event;
+    event.events = (writable ? EPOLLOUT : EPOLLIN) | EPOLLONESHOT;
+    event.data.ptr = data;
+    return epoll_ctl(event_queue, EPOLL_CTL_MOD, fd, &event);
+#else
+    struct kevent event;
+    if (writable) {
+        EV_SET(&event, fd, EVFILT_WRITE, EV_ADD | EV_DISPATCH, 0, 0, data);
+    } else {
+        EV_SET(&event, fd, EVFILT_READ, EV_ENABLE | EV_DISPATCH, 0, 0, data);
+    }
+    return kevent(event_queue, &event, 1, NULL, 0, NULL);
+#endif
+}
+
+// Waits up to timeout_ms, or without limit if it is negative, and stores the
+// data pointers of ready descriptors.
+int event_queue_wait(void **ready, int max_events, int timeout_ms) {
+#ifdef __linux__
+    struct epoll_event events[max_events];
+    int count = epoll_wait(event_queue, events, max_events, timeout_ms);
+    for (int i = 0; i < count; i++) {
+        ready[i] = events[i].data.ptr;
+    }
+#else
+    struct kevent events[max_events];
+    struct timespec timeout = {timeout_ms / 1000, (timeout_ms % 1000) * 1000000L};
+    int count = kevent(event_queue, NULL, 0, events, max_events, timeout_ms < 0 ? NULL : &timeout);
+    for (int i = 0; i < count; i++) {
+        ready[i] = events[i].udata;
+    }
+#endif
+    return count;
+}
+
+int set_nonblocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    return flags == -1 ? -1 : fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+int output_reserve(OutputBuffer *output, size_t length) {
+    if (output->length + length <= output->capacity) {
+        return 0;
+    }
+    size_t capacity = output->capacity > 0 ? output->capacity : 1024;
+    while (output->length + length > capacity) {
+        capacity *= 2;
+    }
+    char *data = (char *)realloc(output->data, capacity);
+    if (data == NULL) {
+        fprintf(stderr, "ERROR: Memory reallocation failed.\n");
+        return -1;
+    }
+    output->data = data;
+    output->capacity = capacity;
+    return 0;
+}
+
+void output_append(OutputBuffer *output, const char *data, size_t length) {
+    if (output_reserve(output, length) == 0) {
+        memcpy(output->data + output->length, data, length);
+        output->length += length;
+    }
+}
+
+void output_printf(OutputBuffer *output, const char *format, ...) {
+    va_list arguments;
+    va_start(arguments, format);
+    int length = vsnprintf(NULL, 0, format, arguments);
+    va_end(arguments);
+    if (length < 0 || output_reserve(output, (size_t)length + 1) != 0) {
+        return;
+    }
+
+    va_start(arguments, format);
+    vsnprintf(output->data + output->length, (size_t)length + 1, format, arguments);
+    va_end(arguments);
+    output->length += length;
+}
+
+void output_matches(OutputBuffer *output, const WordDistance *closest) {
+    output_printf(output, "MATCHES: ");
+    for (int i = 0; i < LEVENSHTEIN_LIST_LIMIT && closest[i].word != NULL; i++) {
+        output_printf(output, "%s (%zu) ", closest[i].word, closest[i].distance);
+    }
+    output_printf(output, "\n");
+}
+
+void connection_send(Connection *connection, const char *message) {
+    output_append(&connection->output, message, strlen(message));
+}
+
+// Writes as much pending output as the socket takes without blocking.
+// Returns 0 when everything is sent, 1 if output remains, -1 on error.
+int connection_flush(Connection *connection) {
+    OutputBuffer *output = &connection->output;
+    while (connection->output_sent < output->length) {
+        ssize_t sent = send(connection->fd, output->data + connection->output_sent, output->length - connection->output_sent, 0);
+        if (sent > 0) {
+            connection->output_sent += sent;
+        } else if (sent == -1 && errno == EINTR) {
+            continue;
+        } else if (sent == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return 1;
+        } else {
+            return -1;
+        }
+    }
+
+    output->length = 0;
+    connection->output_sent = 0;
+    if (output->capacity > 65536) {
+        // Do not keep a large batch reply's buffer around for the rest of the session
+        free(output->data);
+        output->data = NULL;
+        output->capacity = 0;
+    }
+    return 0;
+}
+
+// Writes all of data to a non-blocking socket, waiting while its send buffer is full
+int send_all(int fd, const char *data, size_t length) {
+    while (length > 0) {
+        ssize_t sent = send(fd, data, length, 0);
+        if (sent > 0) {
+            data += sent;
+            length -= sent;
+        } else if (sent == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+            struct pollfd writable = {fd, POLLOUT, 0};
+            poll(&writable, 1, -1);
+        } else {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void connection_close(Connection *connection) {
+    close(connection->fd); // Also removes it from the event queue
+    if (connection->request != NULL) {
+        sentence_request_free(connection->request);
+    }
+    free(connection->buffer);
+    free(connection->output.data);
+    free(connection);
+}
+
+// Sends the pending output, then closes the connection or waits for its next
+// event: room to write if output is left over, otherwise the next input.
+void connection_finish(Connection *connection) {
+    int flushed = connection_flush(connection);
+    if (flushed == -1) {
+        printf("Client disconnected.\n");
+        connection_close(connection);
+    } else if (flushed == 1) {
+        if (event_queue_rearm(connection->fd, connection, true) == -1) {
+            connection_close(connection);
+        }
+    } else if (connection->close_after_flush) {
+        connection_close(connection);
+    } else if (connection->peer_closed) {
+        printf("Client disconnected.\n");
+        connection_close(connection);
+    } else if (event_queue_rearm(connection->fd, connection, false) == -1) {
+        connection_close(connection);
+    }
+}
+
+void accept_connections(int server_fd) {
+    while (1) {
+        int client_fd = accept(server_fd, NULL, NULL);
+        if (client_fd == -1) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                perror("ERROR: Failed to accept connection");
+            }
+            return;
+        }
+
+        Connection *connection = (Connection *)calloc(1, sizeof(Connection));
+        if (connection == NULL || set_nonblocking(client_fd) == -1) {
+            fprintf(stderr, "ERROR: Failed to set up connection.\n");
+            free(connection);
+            close(client_fd);
+            continue;
+        }
+        connection->fd = client_fd;
+
+        // Replies are written whole, so there are no small segments for Nagle to hold back
+        int no_delay = 1;
+        setsockopt(client_fd, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay));
+
+        const char *welcome_message = "\nType 'exit' to disconnect. Type 'shutdown' to stop the server.\nType 'batch' for one result line per input line. Type 'stats' for cache statistics.\nType 'neighbors on' to list the nearest words of correctly spelled words too.\nType 'metric osa' to count swapped adjacent letters as one edit.\n\nHello, this is Text Analysis Server! \n\nPlease enter your input string:\n";
+        connection_send(connection, welcome_message);
+
+        if (event_queue_add(client_fd, connection, true) == -1) {
+            perror("ERROR: Failed to watch connection");
+            connection_close(connection);
+            continue;
+        }
+        connection_finish(connection);
+    }
+}
+
+void handle_client_task(void *arg) {
+    handle_client((Connection *)arg);
+}
+
+// Makes room for the next recv plus a spare byte, dropping consumed bytes before growing
+int connection_reserve_input(Connection *connection) {
+    if (connection->buffer_start > 0) {
+        connection->buffer_length -= connection->buffer_start;
+        connection->buffer_scanned -= connection->buffer_start;
+        memmove(connection->buffer, connection->buffer + connection->buffer_start, connection->buffer_length);
+        connection->buffer_start = 0;
+    }
+    if (connection->buffer_capacity - connection->buffer_length > 4096) {
+        return 0;
+    }
+
+    size_t capacity = connection->buffer_capacity > 0 ? connection->buffer_capacity * 2 : 16384;
+    char *buffer = (char *)realloc(connection->buffer, capacity);
+    if (buffer == NULL) {
+        fprintf(stderr, "ERROR: Memory reallocation failed.\n");
+        return -1;
+    }
+    connection->buffer = buffer;
+    connection->buffer_capacity = capacity;
+    return 0;
+}
+
+// Returns the first unconsumed newline, or NULL if the line is still coming.
+// The search resumes where the previous one ended.
+char *connection_find_newline(Connection *connection) {
+    if (connection->buffer_scanned < connection->buffer_start) {
+        connection->buffer_scanned = connection->buffer_start;
+    }
+    char *newline = NULL;
+    if (connection->buffer_scanned < connection->buffer_length) {
+        newline = memchr(connection->buffer + connection->buffer_scanned, '\n',
+                         connection->buffer_length - connection->buffer_scanned);
+    }
+    connection->buffer_scanned = newline != NULL ? (size_t)(newline - connection->buffer) : connection->buffer_length;
+    return newline;
+}
+
+// Drops the unconsumed input up to and including the next newline, which ends
+// the line being discarded
+void connection_discard_line(Connection *connection) {
+    char *newline = memchr(connection->buffer + connection->buffer_start, '\n',
+                           connection->buffer_length - connection->buffer_start);
+    if (newline == NULL) {
+        connection->buffer_length = connection->buffer_start;
+    } else {
+        connection->buffer_start = (size_t)(newline - connection->buffer) + 1;
+        connection->discarding_line = false;
+    }
+    connection->buffer_scanned = connection->buffer_start;
+}
+
+// Reads what the client sent. Once a full line is buffered the connection is
+// handed to a worker; otherwise it goes back to waiting for input.
+void connection_readable(Connection *connection) {
+    while (1) {
+        if (connection_reserve_input(connection) != 0) {
+            connection_close(connection);
+            return;
+        }
+        ssize_t received = recv(connection->fd, connection->buffer + connection->buffer_length,
+                                connection->buffer_capacity - 1 - connection->buffer_length, 0);
+        if (received > 0) {
+            connection->buffer_length += received;
+            if (connection->discarding_line) {
+                connection_discard_line(connection);
+            }
+            if (connection->buffer_length - connection->buffer_start > (size_t)INPUT_LINE_LIMIT) {
+                if (connection_find_newline(connection) != NULL) {
+                    break; // Hand over the complete lines before reading more
+                }
+                output_printf(&connection->output, "ERROR: Input line is longer than %d characters!\n", INPUT_LINE_LIMIT);
+                connection->discarding_line = true;
+                connection_discard_line(connection);
+            }
+            continue;
+        }
+        if (received == 0) {
+            connection->peer_closed = true; // Lines already received are still answered
+            break;
+        }
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            printf("Client disconnected.\n");
+            connection_close(connection);
+            return;
+        }
+        if (errno != EINTR) {
+            break;
+        }
+    }
+
+    bool line_complete = connection_find_newline(connection) != NULL
+                         || (connection->peer_closed && connection->buffer_length > connection->buffer_start);
+    if (line_complete) {
+        if (thread_pool_submit(&worker_pool, handle_client_task, connection) != 0) {
+            connection_close(connection);
+        }
+    } else if (connection->output.length > 0) {
+        connection_finish(connection); // Only the error for a dropped line to send
+    } else if (connection->peer_closed) {
+        printf("Client disconnected.\n");
+        connection_close(connection);
+    } else if (event_queue_rearm(connection->fd, connection, false) == -1) {
+        connection_close(connection);
+    }
+}
+
+void start_server(int port_number) {
+    int server_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (server_fd == -1) {
+        perror("ERROR: Failed to create socket");
+        exit(EXIT_FAILURE);
+    }
+
+    // Set SO_REUSEADDR to allow reuse of the port
+    int opt = 1;
+    if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0) {
+        perror("ERROR: Failed to set socket options");
+        close(server_fd);
+        exit(EXIT_FAILURE);
+    }
+
+    struct sockaddr_in server_addr;
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_addr.s_addr = INADDR_ANY;
+    server_addr.sin_port = htons(port_number);
+
+    if (bind(server_fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) == -1) {
+        perror("ERROR: Failed to bind socket");
+        close(server_fd); // Close the socket to release the port
+        exit(EXIT_FAILURE);
+    }
+
+    if (listen(server_fd, LISTEN_BACKLOG) == -1) {
+        perror("ERROR: Failed to listen on socket");
+        close(server_fd); // Close the socket to release the port
+        exit(EXIT_FAILURE);
+    }
+
+    int worker_count = WORKER_THREADS > 0 ? WORKER_THREADS : online_cpu_count();
+    int lookup_count = LOOKUP_THREADS > 0 ? LOOKUP_THREADS : online_cpu_count();
+    event_queue = event_queue_create();
+    if (event_queue == -1 || set_nonblocking(server_fd) == -1 || event_queue_add(server_fd, NULL, false) == -1) {
+        perror("ERROR: Failed to set up the event queue");
+        close(server_fd);
+        exit(EXIT_FAILURE);
+    }
+    if (thread_pool_init(&worker_pool, worker_count) != 0 || thread_pool_init(&lookup_pool, lookup_count) != 0) {
+        close(server_fd);
+        exit(EXIT_FAILURE);
+    }
+    // The thread running a lookup scans one slice itself
+    int scan_count = SCAN_THREADS > 0 ? SCAN_THREADS : online_cpu_count();
+    if (scan_count > 1 && thread_pool_init(&scan_pool, scan_count - 1) != 0) {
+        close(server_fd);
+        exit(EXIT_FAILURE);
+    }
+    scan_thread_count = scan_count;
+
+    printf("Server running on port %d with %d worker and %d lookup threads\n", port_number, worker_count, lookup_count);
+
+    void *ready[64];
+    while (1) {
+        int ready_count = event_queue_wait(ready, 64, -1);
+        if (ready_count == -1) {
+            if (errno != EINTR) {
+                perror("ERROR: Failed to wait for events");
+            } else if (dictionary_reload_requested) {
+                dictionary_maintenance_wake(); // SIGHUP landed here, reload without waiting for the next round
+            }
+            continue;
+        }
+
+        for (int i = 0; i < ready_count; i++) {
+            if (ready[i] == NULL) {
+                accept_connections(server_fd); // The listening socket carries no connection
+            } else {
+                Connection *connection = (Connection *)ready[i];
+                if (connection->output_sent < connection->output.length) {
+                    connection_finish(connection); // Writable again, send the rest of the reply
+                } else {
+                    connection_readable(connection);
+                }
+            }
+        }
+    }
+
+    close(server_fd); // Close the server socket when done
+}
+
+// Looks up one word. No lock and no client I/O, so all words of a sentence
+// run in parallel; results are sent afterwards in word order.
+void *thread_function(void *arg) {
+    ThreadData *data = (ThreadData *)arg;
+
+    // Most words are spelled correctly; those skip the search unless the
+    // client asked for their neighbors
+    if (data->options.neighbors || !find_exact_word(data->input_word, data->input_length, data->dictionary, data->closest)) {
+        find_closest_words(data->input_word, data->input_length, data->dictionary, data->options.metric, data->closest);
+    }
+    if (data->closest[0].word != NULL) {
+        data->closest_word = data->closest[0].word;
+        data->is_word_found = data->closest[0].distance == 0;
+    }
+    return NULL;
+}
+
+void lookup_task(void *arg) {
+    ThreadData *data = (ThreadData *)arg;
+    thread_function(data);
+    task_group_done(data->group);
+}
+
+void sentence_request_free(SentenceRequest *request) {
+    if (request->owns_sentence) {
+        free(request->sentence);
+    }
+    free(request->spans);
+    free(request->words);
+    free(request->matches);
+    dictionary_release(request->dictionary);
+    free(request);
+}
+
+// Sends the original and corrected sentences once every word is settled
+void finish_sentence(Connection *connection) {
+    SentenceRequest *request = connection->request;
+
+    OutputBuffer *output = &connection->output;
+
+    // Send the original and corrected sentences to the client, appended word
+    // by word so long sentences cost linear time
+    output_printf(output, "\nINPUT: ");
+    for (int i = 0; i < request->word_count; i++) {
+        output_append(output, request->words[i].input_word, request->words[i].input_length);
+        output_append(output, " ", 1); // Add space between words
+    }
+    output_printf(output, "\nOUTPUT: ");
+    for (int i = 0; i < request->word_count; i++) {
+        const ThreadData *data = &request->words[i];
+        if (!data->is_word_found && data->closest_word != NULL) {
+            output_append(output, data->closest_word, strlen(data->closest_word));
+        } else {
+            output_append(output, data->input_word, data->input_length);
+        }
+        output_append(output, " ", 1);
+    }
+    output_printf(output, "\n\n");
+
+    // Free the per-sentence state; the connection stays open for the next one
+    sentence_request_free(request);
+    connection->request = NULL;
+
+    connection_send(connection, "Please enter your input string:\n");
+}
+
+// Sends the results of the remaining words in order. At a word missing from
+// the dictionary it asks whether to add it and returns; the answer arrives as
+// the next line on the connection and resumes from there.
+void send_sentence_results(Connection *connection) {
+    SentenceRequest *request = connection->request;
+    OutputBuffer *output = &connection->output;
+
+    while (request->next_word < request->word_count) {
+        ThreadData *data = &request->words[request->next_word];
+
+        // Display the word and its position
+        output_printf(output, "\nWORD %02d: %.*s\n", data->word_position, (int)data->input_length, data->input_word);
+        output_matches(output, data->closest);
+
+        // If word is not found, ask if the user wants to add it
+        if (!data->is_word_found) {
+            output_printf(output,
+                          "\nThe WORD %.*s is not present in dictionary. \nDo you want to add this word to dictionary? (y/N): ",
+                          (int)data->input_length, data->input_word);
+            return;
+        }
+        request->next_word++;
+    }
+
+    finish_sentence(connection);
+}
+
+// Returns false if the answer was invalid and the connection is to be closed
+bool handle_add_word_answer(Connection *connection, const char *buffer) {
+    SentenceRequest *request = connection->request;
+    ThreadData *data = &request->words[request->next_word];
+
+    if (buffer[0] == 'y' || buffer[0] == 'Y') {
+        data->is_word_found = 1;
+        // Publish a new snapshot; the one this request holds stays unchanged
+        if (dictionary_add_word(data->input_word, data->input_length) == 0) {
+            connection_send(connection, "The word has been added to the dictionary.\n");
+        } else {
+            connection_send(connection, "The word could not be added to the dictionary.\n");
+        }
+    } else if (buffer[0] == 'n' || buffer[0] == 'N'){
+        connection_send(connection, "The word has been skipped.\n");
+    }else {
+        connection_send(connection, "ERROR: Invalid input, closing connection...\n");
+        connection->close_after_flush = true; // Close the client connection, the server keeps running
+        return false;
+    }
+
+    request->next_word++;
+    send_sentence_results(connection);
+    return true;
+}
+
+// Looks up every word of a sentence in parallel on the lookup pool. Takes
+// ownership of spans; the sentence is borrowed until the request is detached.
+SentenceRequest *lookup_sentence(char *sentence, WordSpan *spans, int input_word_count, LookupOptions options) {
+    SentenceRequest *request = (SentenceRequest *)calloc(1, sizeof(SentenceRequest));
+    if (request == NULL) {
+        fprintf(stderr, "ERROR: Memory allocation failed.\n");
+        free(spans);
+        return NULL;
+    }
+    request->sentence = sentence;
+    request->spans = spans;
+    request->word_count = input_word_count;
+    // All words of the sentence are looked up in the same snapshot
+    request->dictionary = dictionary_acquire();
+    request->words = (ThreadData *)calloc(input_word_count, sizeof(ThreadData));
+    request->matches = (WordDistance *)calloc((size_t)input_word_count * LEVENSHTEIN_LIST_LIMIT, sizeof(WordDistance));
+    if (request->words == NULL || request->matches == NULL) {
+        fprintf(stderr, "ERROR: Memory allocation failed.\n");
+        sentence_request_free(request);
+        return NULL;
+    }
+
+    TaskGroup group;
+    task_group_init(&group, input_word_count);
+
+    for (int i = 0; i < input_word_count; i++) {
+        ThreadData *data = &request->words[i];
+        data->input_word = sentence + spans[i].offset;
+        data->input_length = spans[i].length;
+        data->dictionary = request->dictionary;
+        data->group = &group;
+        data->closest = request->matches + (size_t)i * LEVENSHTEIN_LIST_LIMIT;
+        data->options = options;
+        data->is_word_found = 0;
+        data->closest_word = NULL; // Initialize closest_word to NULL
+        data->word_position = i + 1; // Assign the word position
+
+        // Lookups run on the persistent lookup pool instead of a thread per word
+        if (thread_pool_submit(&lookup_pool, lookup_task, data) != 0) {
+            fprintf(stderr, "ERROR: Failed to submit lookup for word %d.\n", i + 1);
+            thread_function(data);
+            task_group_done(&group);
+        }
+    }
+
+    task_group_wait(&group);
+    return request;
+}
+
+// Gives a request its own copy of the sentence, so it can wait for add-word
+// answers while the receive buffer is reused. One copy per sentence, the
+// spans are offsets and stay as they are.
+int sentence_request_detach(SentenceRequest *request) {
+    const WordSpan *last = &request->spans[request->word_count - 1];
+    size_t length = last->offset + last->length;
+    char *sentence = (char *)malloc(length);
+    if (sentence == NULL) {
+        fprintf(stderr, "ERROR: Memory allocation failed.\n");
+        return -1;
+    }
+    memcpy(sentence, request->sentence, length);
+    request->sentence = sentence;
+    request->owns_sentence = true;
+    for (int i = 0; i < request->word_count; i++) {
+        request->words[i].input_word = sentence + request->spans[i].offset;
+    }
+    return 0;
+}
+
+void process_and_send_words(Connection *connection, char *input) {
+    int input_word_count = 0;
+    WordSpan *spans = process_input(&input_word_count, input);
+    if (spans == NULL) {
+        connection_send(connection, "Please enter your input string:\n");
+        return;
+    }
+
+    // Report the looked-up words one by one
+    connection->request = lookup_sentence(input, spans, input_word_count, connection->options);
+    if (connection->request != NULL) {
+        send_sentence_results(connection);
+    }
+
+    // A pending add-word prompt keeps the request beyond this line
+    if (connection->request != NULL && sentence_request_detach(connection->request) != 0) {
+        sentence_request_free(connection->request);
+        connection->request = NULL;
+        connection_send(connection, "ERROR: Out of memory, closing connection...\n");
+        connection->close_after_flush = true;
+    }
+}
+
+bool input_is_supported(const char *input) {
+    for (size_t i = 0; input[i] != '\0'; i++) {
+        if (!isalpha((unsigned char)input[i]) && !isspace((unsigned char)input[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Batch mode: appends one tab-separated result line for an input line,
+//   OK <TAB> corrected sentence <TAB> word=match:distance,match:distance word=...
+// or ERROR <TAB> reason. Unknown words are corrected without prompting.
+void process_batch_line(char *input, OutputBuffer *output, LookupOptions options) {
+    if (!input_is_supported(input)) {
+        output_printf(output, "ERROR\tunsupported characters\n");
+        return;
+    }
+
+    int input_word_count = 0;
+    WordSpan *spans = process_input(&input_word_count, input);
+    if (spans == NULL) {
+        output_printf(output, "OK\t\t\n");
+        return;
+    }
+    SentenceRequest *request = lookup_sentence(input, spans, input_word_count, options);
+    if (request == NULL) {
+        output_printf(output, "ERROR\tout of memory\n");
+        return;
+    }
+
+    output_printf(output, "OK\t");
+    for (int i = 0; i < request->word_count; i++) {
+        const ThreadData *data = &request->words[i];
+        if (i > 0) {
+            output_append(output, " ", 1);
+        }
+        if (!data->is_word_found && data->closest_word != NULL) {
+            output_append(output, data->closest_word, strlen(data->closest_word));
+        } else {
+            output_append(output, data->input_word, data->input_length);
+        }
+    }
+    output_printf(output, "\t");
+    for (int i = 0; i < request->word_count; i++) {
+        const ThreadData *data = &request->words[i];
+        if (i > 0) {
+            output_append(output, " ", 1);
+        }
+        output_append(output, data->input_word, data->input_length);
+        output_append(output, "=", 1);
+        for (int j = 0; j < LEVENSHTEIN_LIST_LIMIT && data->closest[j].word != NULL; j++) {
+            output_printf(output, j > 0 ? ",%s:%zu" : "%s:%zu", data->closest[j].word, data->closest[j].distance);
+        }
+    }
+    output_printf(output, "\n");
+    sentence_request_free(request);
+}
+
+// Consumes the next line of the connection buffer and returns it in place,
+// NUL-terminated without its newline, or NULL if no complete line has
+// arrived. The line stays valid until the connection reads again. Lines
+// longer than INPUT_LINE_LIMIT are answered with an error and skipped.
+char *connection_take_line(Connection *connection) {
+    while (1) {
+        char *newline = connection_find_newline(connection);
+        if (newline == NULL) {
+            if (!connection->peer_closed || connection->buffer_length == connection->buffer_start) {
+                return NULL;
+            }
+            newline = connection->buffer + connection->buffer_length; // The spare byte
+        }
+
+        char *line = connection->buffer + connection->buffer_start;
+        *newline = '\0';
+        connection->buffer_start = (size_t)(newline - connection->buffer) + 1;
+        if (connection->buffer_start >= connection->buffer_length) {
+            connection->buffer_start = connection->buffer_length = connection->buffer_scanned = 0;
+        }
+        if (newline - line <= INPUT_LINE_LIMIT) {
+            return line;
+        }
+        output_printf(&connection->output, "ERROR: Input line is longer than %d characters!\n", INPUT_LINE_LIMIT);
+    }
+}
+
+// Answers every buffered line of a batch connection; the replies go out together
+void handle_batch_lines(Connection *connection) {
+    char *line;
+
+    while ((line = connection_take_line(connection)) != NULL) {
+        line[strcspn(line, "\r")] = '\0';
+        process_batch_line(line, &connection->output, connection->options);
+    }
+}
+
+// Handles the buffered lines of a connection on a worker thread
+void handle_client(Connection *connection) {
+    int client_fd = connection->fd;
+    char *buffer;
+
+    while (!connection->batch_mode && (buffer = connection_take_line(connection)) != NULL) {
+        // Remove trailing carriage return; commands are matched against the whole line
+        buffer[strcspn(buffer, "\r")] = '\0';
+        printf("Client says: %s\n", buffer);
+
+        // A pending add-word prompt takes the line as its answer
+        if (connection->request != NULL) {
+            if (!handle_add_word_answer(connection, buffer)) {
+                break;
+            }
+            continue;
+        }
+
+        // Shutdown command handling
+        if (strncmp(buffer, "shutdown", 8) == 0) {
+            // Added words must be on disk before exiting
+            if (wal_sync() != 0) {
+                connection_send(connection, "ERROR: Added words could not be saved, the server keeps running.\n");
+                continue;
+            }
+            connection_send(connection, "Shutting down the server...\n");
+            send_all(client_fd, connection->output.data + connection->output_sent, connection->output.length - connection->output_sent);
+            close(client_fd);
+            exit(0); // Exit the server
+        }
+
+        // Exit command handling
+        if (strncmp(buffer, "exit", 4) == 0) {
+            connection_send(connection, "Thank you for using Text Analysis Server! Good Bye!\n");
+            connection->close_after_flush = true;
+            break;
+        }
+
+        // Stats command: lookup cache and deletion index counters
+        if (strcmp(buffer, "stats") == 0) {
+            unsigned long long hits = atomic_load(&result_cache_hits);
+            unsigned long long misses = atomic_load(&result_cache_misses);
+            unsigned long long lookups = atomic_load(&deletes_lookups);
+            unsigned long long short_lookups = atomic_load(&deletes_short);
+            output_printf(&connection->output,
+                          "STATS cache_hits=%llu cache_misses=%llu cache_hit_rate=%.1f%% cache_entries=%d"
+                          " deletes_lookups=%llu deletes_short=%llu deletes_short_rate=%.1f%%\n",
+                          hits, misses, hits + misses > 0 ? 100.0 * hits / (hits + misses) : 0.0, result_cache_count(),
+                          lookups, short_lookups, lookups > 0 ? 100.0 * short_lookups / lookups : 0.0);
+            continue;
+        }
+
+        // Neighbors command: whether known words are searched for their nearest
+        // words or answered as exact matches (the default)
+        if (strcmp(buffer, "neighbors on") == 0 || strcmp(buffer, "neighbors off") == 0) {
+            connection->options.neighbors = strcmp(buffer, "neighbors on") == 0;
+            connection_send(connection, connection->options.neighbors ? "NEIGHBORS ON\n" : "NEIGHBORS OFF\n");
+            continue;
+        }
+
+        // Metric command: 'metric osa' (or 'metric damerau') counts swapped
+        // adjacent characters as one edit, 'metric levenshtein' (the default) as two
+        if (strncmp(buffer, "metric ", 7) == 0) {
+            const char *metric = buffer + 7;
+            if (strcmp(metric, "osa") == 0 || strcmp(metric, "damerau") == 0) {
+                connection->options.metric = METRIC_OSA;
+                connection_send(connection, "METRIC OSA\n");
+            } else if (strcmp(metric, "levenshtein") == 0) {
+                connection->options.metric = METRIC_LEVENSHTEIN;
+                connection_send(connection, "METRIC LEVENSHTEIN\n");
+            } else {
+                connection_send(connection, "ERROR: Unknown metric, use 'metric osa', 'metric damerau' or 'metric levenshtein'.\n");
+            }
+            continue;
+        }
+
+        // Batch command: from the next line on, every line is a sentence
+        if (strcmp(buffer, "batch") == 0) {
+            connection_send(connection, "BATCH READY\n");
+            connection->batch_mode = true;
+            break;
+        }
+
+        // Check for unsupported characters
+        if (!input_is_supported(buffer)) {
+            connection_send(connection, "ERROR: Input string contains unsupported characters!\n");
+            connection->close_after_flush = true; // Close connection
+            break;
+        }
+
+        // Process and send words; the session continues with the next line
+        process_and_send_words(connection, buffer);
+    }
+
+    if (connection->batch_mode && !connection->close_after_flush) {
+        handle_batch_lines(connection);
+    }
+
+    // One write for the whole reply, then wait for the next sentence or the
+    // answer to an add-word prompt
+    connection_finish(connection);
+}